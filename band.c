@@ -0,0 +1,380 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+
+enum {
+	Ndim = 0,
+	N = 64*1024,
+	Nkl = 8,
+	Nku = 8,
+};
+
+static double tol = 1e-8;	/* on the error of x, which should be all ones */
+
+typedef struct Band Band;
+
+/*
+ *	the band of a column stripe, lapack style: local column j keeps
+ *	rows g-kl-ku .. g+kl of its global column g, so element (i,g)
+ *	is bandcol(b, j)[i-g]. the extra kl rows above the band hold
+ *	the fill that row swaps bring into u.
+ */
+struct Band {
+	double *m;
+	size_t size;
+	int n;
+	int kl;
+	int ku;
+	int ld;
+	int ncols;
+};
+
+static Band *
+bandalloc(int n, int kl, int ku, int ncols)
+{
+	Band *b;
+
+	b = malloc(sizeof b[0]);
+	memset(b, 0, sizeof b[0]);
+	b->n = n;
+	b->kl = kl;
+	b->ku = ku;
+	b->ld = 2*kl + ku + 1;
+	b->ncols = ncols;
+	b->size = (size_t)ncols * b->ld;
+	b->m = hugealloc(b->size * sizeof b->m[0]);
+	if(b->m == NULL){
+		free(b);
+		return NULL;
+	}
+	return b;
+}
+
+static double *
+bandcol(Band *b, int j)
+{
+	return b->m + (size_t)j*b->ld + b->kl + b->ku;
+}
+
+/* local index of the first column of ours at global index g or up */
+static int
+firstcol(int g)
+{
+	int j;
+
+	j = g / cube_nranks;
+	if(g % cube_nranks > cube_id)
+		j++;
+	return j;
+}
+
+static int blocksize;
+static uint64 seed;
+
+/*
+ *	every rank can tell any element without asking anyone, which
+ *	is what the residual check wants. with a block size the band
+ *	is block tridiagonal, blocks of blocksize on the diagonals.
+ *	the diagonal outweighs the rest of its row, so the matrix is
+ *	well conditioned and the solution can be checked to the last
+ *	few bits.
+ */
+static double
+elem(int i, int j, int kl, int ku)
+{
+	uint64 z;
+	double v;
+
+	if(i - j > kl || j - i > ku)
+		return 0.0;
+	if(blocksize > 0 && abs(i/blocksize - j/blocksize) > 1)
+		return 0.0;
+	z = seed + ((uint64)i << 32 | (uint32)j) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	v = 1.0 - 2.0 * (z >> 11) * (1.0 / (1ull << 53));
+	if(i == j)
+		v += kl+ku+1;
+	return v;
+}
+
+/*
+ *	lu with partial pivoting, one column per step as in matrix2.c,
+ *	but the pivot search and the broadcast cover only the kl rows
+ *	below the diagonal, and the update only the kl+ku columns that
+ *	the pivot row reaches. the right hand side is on every rank
+ *	and gets the same swaps and multipliers as it goes, so this is
+ *	also the forward substitution.
+ */
+static int
+bandlu(Band *b, double *rhs)
+{
+	int n = b->n, kl = b->kl, w = b->kl + b->ku;
+	double h[kl+1];
+	double *c, piv, maxval, t;
+	int i, j, g, m, row, pivrow;
+
+	for(row = 0; row < n; row++){
+		m = n-1-row < kl ? n-1-row : kl;
+		if(row % cube_nranks == cube_id){
+			c = bandcol(b, firstcol(row));
+			maxval = fabs(c[0]);
+			pivrow = row;
+			for(i = 1; i <= m; i++){
+				if(fabs(c[i]) > maxval){
+					maxval = fabs(c[i]);
+					pivrow = row+i;
+				}
+			}
+			memcpy(h, c, (m+1) * sizeof h[0]);
+		}
+		cubebroadcast(
+			row % cube_nranks,
+			(struct iovec[]){
+				{&pivrow, sizeof pivrow},
+				{h, (m+1) * sizeof h[0]}
+			},
+			2
+		);
+		if(h[pivrow-row] == 0.0)
+			return -1;
+
+		if(pivrow != row){
+			for(j = firstcol(row); j < b->ncols; j++){
+				g = j*cube_nranks + cube_id;
+				if(g > row+w)
+					break;
+				c = bandcol(b, j);
+				t = c[row-g];
+				c[row-g] = c[pivrow-g];
+				c[pivrow-g] = t;
+			}
+			t = h[0];
+			h[0] = h[pivrow-row];
+			h[pivrow-row] = t;
+			t = rhs[row];
+			rhs[row] = rhs[pivrow];
+			rhs[pivrow] = t;
+		}
+		piv = h[0];
+		for(i = 1; i <= m; i++)
+			h[i] /= piv;
+		if(row % cube_nranks == cube_id){
+			c = bandcol(b, firstcol(row));
+			for(i = 1; i <= m; i++)
+				c[i] = h[i];
+		}
+
+		for(j = firstcol(row+1); j < b->ncols; j++){
+			g = j*cube_nranks + cube_id;
+			if(g > row+w)
+				break;
+			c = bandcol(b, j);
+			t = c[row-g];
+			if(t == 0.0)
+				continue;
+			for(i = 1; i <= m; i++)
+				c[row+i-g] -= h[i]*t;
+		}
+		for(i = 1; i <= m; i++)
+			rhs[row+i] -= h[i]*rhs[row];
+	}
+	return 0;
+}
+
+/*
+ *	back substitution, from the last column up. the owner of a
+ *	column divides out the diagonal and broadcasts the solution
+ *	along with the kl+ku entries of u above it.
+ */
+static void
+bandsolve(Band *b, double *rhs)
+{
+	int n = b->n, w = b->kl + b->ku;
+	double h[w+1];
+	double *c;
+	int k, m, g;
+
+	for(g = n-1; g >= 0; g--){
+		m = g < w ? g : w;
+		if(g % cube_nranks == cube_id){
+			c = bandcol(b, firstcol(g));
+			h[0] = rhs[g] / c[0];
+			for(k = 1; k <= m; k++)
+				h[k] = c[-k];
+		}
+		cubebroadcast(g % cube_nranks, (struct iovec[]){{h, (m+1) * sizeof h[0]}}, 1);
+		rhs[g] = h[0];
+		for(k = 1; k <= m; k++)
+			rhs[g-k] -= h[k]*h[0];
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: band [-p nranks] [-b blocksize] [dim [n [kl [ku]]]]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Band *b;
+	double *rhs, *x, *y, *c;
+	double resid, err;
+	int64 start, lu, solve;
+	int i, j, g, lo, hi;
+	int dim = Ndim;
+	int n, kl, ku, ncols, nranks;
+	int opt;
+
+	nranks = 0;
+	while((opt = getopt(argc, argv, "p:b:")) != -1){
+		switch(opt){
+		case 'p':
+			nranks = strtol(optarg, NULL, 10);
+			break;
+		case 'b':
+			blocksize = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	n = N;
+	kl = Nkl;
+	ku = Nku;
+	if(argc > 0)
+		dim = strtol(argv[0], NULL, 10);
+	if(argc > 1)
+		n = strtol(argv[1], NULL, 10);
+	if(argc > 2)
+		kl = ku = strtol(argv[2], NULL, 10);
+	if(argc > 3)
+		ku = strtol(argv[3], NULL, 10);
+	/* block tridiagonal fits in a band reaching two blocks out */
+	if(blocksize > 0)
+		kl = ku = 2*blocksize - 1;
+
+	if(dim < 0 || dim > 20){
+		printf("crazy dim %d (want 0 <= dim <= 20)\n", dim);
+		exit(1);
+	}
+	if(nranks == 0)
+		nranks = 1 << dim;
+	if(nranks < 1 || nranks > 1<<20 || n < 1 || kl < 0 || ku < 0 || blocksize < 0)
+		usage();
+
+	seed = getpid();
+	initcuben(nranks);
+	proftag(cube_id);
+	cubebroadcast(0, (struct iovec[]){{&seed, sizeof seed}}, 1);
+
+	ncols = firstcol(n);
+	if(ncols <= 0){
+		fprintf(stderr, "matrix %d is too small for %d ranks\n", n, cube_nranks);
+		exit(1);
+	}
+
+	/* allocated after initcube, so the band is local to this rank */
+	b = bandalloc(n, kl, ku, ncols);
+	if(b == NULL){
+		fprintf(stderr, "%d: cannot allocate band of %d columns\n", cube_id, ncols);
+		exit(1);
+	}
+	for(j = 0; j < ncols; j++){
+		g = j*cube_nranks + cube_id;
+		c = bandcol(b, j);
+		lo = g-ku > 0 ? g-ku : 0;
+		hi = g+kl < n-1 ? g+kl : n-1;
+		for(i = lo; i <= hi; i++)
+			c[i-g] = elem(i, g, kl, ku);
+	}
+
+	/* b = a*1, so x should come out all ones */
+	rhs = malloc(n * sizeof rhs[0]);
+	x = malloc(n * sizeof x[0]);
+	y = malloc(n * sizeof y[0]);
+	for(i = 0; i < n; i++){
+		rhs[i] = 0.0;
+		lo = i-kl > 0 ? i-kl : 0;
+		hi = i+ku < n-1 ? i+ku : n-1;
+		for(j = lo; j <= hi; j++)
+			rhs[i] += elem(i, j, kl, ku);
+	}
+	memcpy(x, rhs, n * sizeof x[0]);
+
+	start = nsec();
+	if(bandlu(b, x) == -1){
+		if(cube_id == 0)
+			fprintf(stderr, "band: singular matrix\n");
+		endcube();
+	}
+	lu = nsec() - start;
+	start = nsec();
+	bandsolve(b, x);
+	solve = nsec() - start;
+
+	/* a*x from the columns each rank has, summed over the cube */
+	memset(y, 0, n * sizeof y[0]);
+	for(j = 0; j < ncols; j++){
+		g = j*cube_nranks + cube_id;
+		lo = g-ku > 0 ? g-ku : 0;
+		hi = g+kl < n-1 ? g+kl : n-1;
+		for(i = lo; i <= hi; i++)
+			y[i] += elem(i, g, kl, ku) * x[g];
+	}
+	cubeallreduce(y, n, Rsum);
+	resid = 0.0;
+	err = 0.0;
+	for(i = 0; i < n; i++){
+		if(fabs(y[i] - rhs[i]) > resid)
+			resid = fabs(y[i] - rhs[i]);
+		if(fabs(x[i] - 1.0) > err)
+			err = fabs(x[i] - 1.0);
+	}
+
+	if(cube_id == 0)
+		printf("band: %d unknowns, kl %d ku %d on %d ranks, %.1f MB per rank (dense %.1f MB), lu %.4f s, solve %.4f s, residual %.2e, max error %.2e\n",
+			n, kl, ku, cube_nranks, b->size * 8e-6, (double)n * ncols * 8e-6,
+			lu*1e-9, solve*1e-9, resid, err);
+
+	/* every rank has all of x, so they all agree on this */
+	if(!(err <= tol)){
+		if(cube_id == 0){
+			fprintf(stderr, "band: max error %.2e is over %.0e\n", err, tol);
+			while(waitpid(-1, NULL, 0) > 0)
+				;
+		}
+		exit(1);
+	}
+
+	endcube();
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+
+enum {
+	Ndim = 0,
+	N = 64,
+	Nbatch = 1024,
+	Nlane = 8,
+};
+
+/*
+ *	a group holds Nlane matrices interleaved element by element,
+ *	so that element (i,j) of lane l lives at a[(i*n+j)*Nlane+l].
+ *	every inner loop below runs over the lanes, which the compiler
+ *	turns into straight simd on whatever vector width it has.
+ */
+#define A(a, n, i, j) ((a) + ((i)*(n)+(j))*Nlane)
+
+static void
+swaplane(double *a, int n, int l, int p, int q, int col)
+{
+	double t;
+	int j;
+	for(j = col; j < n; j++){
+		t = A(a, n, p, j)[l];
+		A(a, n, p, j)[l] = A(a, n, q, j)[l];
+		A(a, n, q, j)[l] = t;
+	}
+}
+
+/*
+ *	the same partially pivoted elimination as in matrix2.c, but
+ *	for Nlane independent matrices at once. pivots are chosen per
+ *	lane, so only the row swap has to step out of the lane loop.
+ */
+int
+gaussbatch(double *a, int n)
+{
+	double rowhead[n*Nlane];
+	double piv[Nlane], maxval[Nlane];
+	int pivrow[Nlane];
+	int i, j, l, row;
+	int ntiny;
+
+	ntiny = 0;
+	for(row = 0; row < n; row++){
+		for(l = 0; l < Nlane; l++){
+			piv[l] = A(a, n, row, row)[l];
+			maxval[l] = fabs(piv[l]);
+			pivrow[l] = row;
+		}
+		for(i = row+1; i < n; i++){
+			double *p = A(a, n, i, row);
+			for(l = 0; l < Nlane; l++){
+				if(fabs(p[l]) > maxval[l]){
+					maxval[l] = fabs(p[l]);
+					pivrow[l] = i;
+				}
+			}
+		}
+		for(l = 0; l < Nlane; l++){
+			if(maxval[l] < 1e-9)
+				ntiny++;
+			if(pivrow[l] != row)
+				swaplane(a, n, l, pivrow[l], row, row);
+			piv[l] = 1.0 / A(a, n, row, row)[l];
+		}
+
+		for(i = row+1; i < n; i++)
+			for(l = 0; l < Nlane; l++)
+				rowhead[i*Nlane+l] = A(a, n, i, row)[l];
+		for(j = row; j < n; j++){
+			double *p = A(a, n, row, j);
+			for(l = 0; l < Nlane; l++)
+				p[l] = p[l] * piv[l];
+		}
+		for(i = row+1; i < n; i++){
+			double *h = rowhead + i*Nlane;
+			for(j = row; j < n; j++){
+				double *p = A(a, n, i, j);
+				double *r = A(a, n, row, j);
+				for(l = 0; l < Nlane; l++)
+					p[l] = p[l] - h[l]*r[l];
+			}
+		}
+	}
+	return ntiny;
+}
+
+int
+main(int argc, char *argv[])
+{
+	double *m, *a;
+	double tot[2], tmax;
+	int64 start, end;
+	int i, l, g;
+	int dim = Ndim;
+	int n, nmat, nlocal, ngroups;
+	int ntiny;
+
+	n = N;
+	nmat = Nbatch;
+	if(argc > 1)
+		dim = strtol(argv[1], NULL, 10);
+	if(argc > 2)
+		n = strtol(argv[2], NULL, 10);
+	if(argc > 3)
+		nmat = strtol(argv[3], NULL, 10);
+
+	if(dim < 0 || dim > 20){
+		printf("crazy dim %d (want 0 <= dim <= 20)\n", dim);
+		exit(1);
+	}
+	if(n <= 0 || nmat <= 0){
+		printf("crazy batch of %d %dx%d matrices\n", nmat, n, n);
+		exit(1);
+	}
+
+	long seed;
+	seed = getpid();
+	initcube(dim);
+	seed = (seed << dim) | cube_id;
+
+	/* whole matrices are dealt out to ranks, nobody talks to anybody */
+	nlocal = nmat >> cube_dim;
+	if((nmat & cube_mask) != 0 && (nmat & cube_mask) > cube_id)
+		nlocal++;
+	ngroups = (nlocal + Nlane-1) / Nlane;
+
+	/* after initcube, so the batch is first touched by its rank */
+	m = NULL;
+	if(ngroups > 0)
+		m = hugealloc((size_t)ngroups * n*n*Nlane * sizeof m[0]);
+	if(ngroups > 0 && m == NULL){
+		fprintf(stderr, "%d: cannot allocate %d groups of %dx%d\n", cube_id, ngroups, n, n);
+		exit(1);
+	}
+
+	srand48(seed | cube_id);
+	for(g = 0; g < ngroups; g++){
+		a = m + (size_t)g*n*n*Nlane;
+		for(i = 0; i < n*n; i++){
+			for(l = 0; l < Nlane; l++){
+				/* pad the last group with identities */
+				if(g*Nlane+l >= nlocal){
+					a[i*Nlane+l] = (i/n == i%n) ? 1.0 : 0.0;
+					continue;
+				}
+				do {
+					a[i*Nlane+l] = 1.0 - 2.0*drand48();
+				} while(fabs(a[i*Nlane+l]) < 1e-6);
+			}
+		}
+	}
+
+	ntiny = 0;
+	start = nsec();
+	for(g = 0; g < ngroups; g++)
+		ntiny += gaussbatch(m + (size_t)g*n*n*Nlane, n);
+	end = nsec();
+
+	/* more ranks than matrices leaves some with nothing to do */
+	if(nlocal > 0)
+		printf("%3d: %d %dx%d matrices, %d tiny pivots, %.4f s, %.1f matrices/s\n",
+			cube_id, nlocal, n, n, ntiny, (end-start)*1e-9, nlocal / ((end-start)*1e-9));
+
+	/* the batch is done when the slowest rank is */
+	tot[0] = nlocal;
+	tot[1] = ntiny;
+	cubeallreduce(tot, 2, Rsum);
+	tmax = (end-start)*1e-9;
+	cubeallreduce(&tmax, 1, Rmax);
+	if(cube_id == 0)
+		printf("batch: %.0f %dx%d matrices on %d ranks, %.0f tiny pivots, %.4f s, %.1f matrices/s\n",
+			tot[0], n, n, cube_nranks, tot[1], tmax, tot[0] / tmax);
+
+	endcube();
+
+	return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+
+enum {
+	Ndim = 0,
+	N = 256,
+};
+
+typedef struct Csr Csr;
+
+/*
+ *	the rows lo..hi-1 of a sparse matrix in compressed sparse row
+ *	form. column indices are local: x[0..nleft) is the halo from the
+ *	partition below us, x[nleft..nleft+nrows) is our own part and
+ *	the rest is the halo from the partition above.
+ */
+struct Csr {
+	int64 n;
+	int64 lo, hi;
+	int nrows;
+	int nleft, nright;
+	int sendleft, sendright;
+	int ldim, rdim;
+	int *rowptr;
+	int *colidx;
+	double *val;
+	double *diag;
+};
+
+/*
+ *	partitions are laid along a gray code, so that neighbouring
+ *	partitions are always neighbours in the cube as well and the
+ *	halo goes over a single cube_fd link.
+ */
+static uint32
+gray(uint32 k)
+{
+	return k ^ (k >> 1);
+}
+
+static uint32
+invgray(uint32 g)
+{
+	uint32 s;
+	for(s = 1; s < 32; s <<= 1)
+		g ^= g >> s;
+	return g;
+}
+
+/*
+ *	5-point laplacian on an nx by nx grid, partitioned by grid lines.
+ */
+static Csr *
+mkpoisson(int nx, int part, int nparts)
+{
+	Csr *a;
+	int64 row, col, lo, hi, minc, maxc;
+	int line, nlines, x, y, i, k, nnz;
+	int64 cols[5];
+	double vals[5];
+
+	a = malloc(sizeof a[0]);
+	memset(a, 0, sizeof a[0]);
+
+	nlines = nx / nparts;
+	line = part*nlines + (part < nx % nparts ? part : nx % nparts);
+	if(part < nx % nparts)
+		nlines++;
+	lo = (int64)line * nx;
+	hi = lo + (int64)nlines * nx;
+
+	a->n = (int64)nx * nx;
+	a->lo = lo;
+	a->hi = hi;
+	a->nrows = hi - lo;
+	a->rowptr = malloc((a->nrows+1) * sizeof a->rowptr[0]);
+	a->colidx = malloc(5 * a->nrows * sizeof a->colidx[0]);
+	a->val = malloc(5 * a->nrows * sizeof a->val[0]);
+	a->diag = malloc(a->nrows * sizeof a->diag[0]);
+
+	minc = lo;
+	maxc = hi-1;
+	nnz = 0;
+	for(row = lo; row < hi; row++){
+		y = row / nx;
+		x = row % nx;
+		k = 0;
+		if(y > 0){
+			cols[k] = row-nx;
+			vals[k++] = -1.0;
+		}
+		if(x > 0){
+			cols[k] = row-1;
+			vals[k++] = -1.0;
+		}
+		cols[k] = row;
+		vals[k++] = 4.0;
+		if(x < nx-1){
+			cols[k] = row+1;
+			vals[k++] = -1.0;
+		}
+		if(y < nx-1){
+			cols[k] = row+nx;
+			vals[k++] = -1.0;
+		}
+		a->rowptr[row-lo] = nnz;
+		for(i = 0; i < k; i++){
+			col = cols[i];
+			if(col < minc)
+				minc = col;
+			if(col > maxc)
+				maxc = col;
+			if(col == row)
+				a->diag[row-lo] = vals[i];
+			/* stash the global column for now */
+			a->colidx[nnz] = col - lo;
+			a->val[nnz] = vals[i];
+			nnz++;
+		}
+	}
+	a->rowptr[a->nrows] = nnz;
+
+	a->nleft = lo - minc;
+	a->nright = maxc+1 - hi;
+	for(i = 0; i < nnz; i++)
+		a->colidx[i] += a->nleft;
+
+	return a;
+}
+
+/*
+ *	tell the neighbours how much of their part we need.
+ *	partition k talks to k-1 and k+1; even partitions go right
+ *	first and odd ones left first so every pair meets at once.
+ */
+static void
+halosetup(Csr *a, int part, int nparts)
+{
+	int phase, dir;
+
+	a->ldim = -1;
+	a->rdim = -1;
+	if(part > 0)
+		a->ldim = __builtin_ctz(gray(part) ^ gray(part-1));
+	if(part < nparts-1)
+		a->rdim = __builtin_ctz(gray(part) ^ gray(part+1));
+
+	if((a->nleft > 0 && a->ldim == -1) || (a->nright > 0 && a->rdim == -1)){
+		fprintf(stderr, "%d: partition %d needs a missing neighbour\n", cube_id, part);
+		exit(1);
+	}
+
+	for(phase = 0; phase < 2; phase++){
+		dir = (part & 1) ^ phase;
+		if(dir == 0 && a->rdim != -1){
+			cubeexchange(a->rdim,
+				(struct iovec[]){{&a->nright, sizeof a->nright}}, 1,
+				(struct iovec[]){{&a->sendright, sizeof a->sendright}}, 1);
+		}
+		if(dir == 1 && a->ldim != -1){
+			cubeexchange(a->ldim,
+				(struct iovec[]){{&a->nleft, sizeof a->nleft}}, 1,
+				(struct iovec[]){{&a->sendleft, sizeof a->sendleft}}, 1);
+		}
+	}
+}
+
+static void
+haloexchange(Csr *a, double *x, int part)
+{
+	double *own;
+	int phase, dir;
+
+	own = x + a->nleft;
+	for(phase = 0; phase < 2; phase++){
+		dir = (part & 1) ^ phase;
+		if(dir == 0 && a->rdim != -1){
+			cubeexchange(a->rdim,
+				(struct iovec[]){{own + a->nrows - a->sendright, a->sendright * sizeof x[0]}}, 1,
+				(struct iovec[]){{own + a->nrows, a->nright * sizeof x[0]}}, 1);
+		}
+		if(dir == 1 && a->ldim != -1){
+			cubeexchange(a->ldim,
+				(struct iovec[]){{own, a->sendleft * sizeof x[0]}}, 1,
+				(struct iovec[]){{x, a->nleft * sizeof x[0]}}, 1);
+		}
+	}
+}
+
+static void
+spmv(Csr *a, double *y, double *x)
+{
+	double sum;
+	int i, k;
+
+	for(i = 0; i < a->nrows; i++){
+		sum = 0.0;
+		for(k = a->rowptr[i]; k < a->rowptr[i+1]; k++)
+			sum += a->val[k] * x[a->colidx[k]];
+		y[i] = sum;
+	}
+}
+
+/*
+ *	jacobi preconditioned conjugate gradient. p carries the halo,
+ *	everything else is just the owned rows. the two dot products
+ *	at the end of an iteration share one allreduce.
+ */
+static int
+pcg(Csr *a, double *x, double *b, double tol, int maxiter, int part, double *resid)
+{
+	double *r, *z, *p, *q, *own;
+	double alpha, beta, rz, bnorm, dot[2];
+	int i, it, n;
+
+	n = a->nrows;
+	r = malloc(n * sizeof r[0]);
+	z = malloc(n * sizeof z[0]);
+	q = malloc(n * sizeof q[0]);
+	p = malloc((a->nleft + n + a->nright) * sizeof p[0]);
+	own = p + a->nleft;
+
+	dot[0] = 0.0;
+	dot[1] = 0.0;
+	for(i = 0; i < n; i++){
+		x[i] = 0.0;
+		r[i] = b[i];
+		z[i] = r[i] / a->diag[i];
+		own[i] = z[i];
+		dot[0] += r[i]*z[i];
+		dot[1] += b[i]*b[i];
+	}
+	cubeallreduce(dot, 2, Rsum);
+	rz = dot[0];
+	bnorm = sqrt(dot[1]);
+
+	*resid = 1.0;
+	for(it = 0; it < maxiter; it++){
+		haloexchange(a, p, part);
+		spmv(a, q, p);
+
+		dot[0] = 0.0;
+		for(i = 0; i < n; i++)
+			dot[0] += own[i]*q[i];
+		cubeallreduce(dot, 1, Rsum);
+		alpha = rz / dot[0];
+
+		dot[0] = 0.0;
+		dot[1] = 0.0;
+		for(i = 0; i < n; i++){
+			x[i] += alpha*own[i];
+			r[i] -= alpha*q[i];
+			z[i] = r[i] / a->diag[i];
+			dot[0] += r[i]*z[i];
+			dot[1] += r[i]*r[i];
+		}
+		cubeallreduce(dot, 2, Rsum);
+
+		*resid = sqrt(dot[1]) / bnorm;
+		if(*resid < tol){
+			it++;
+			break;
+		}
+
+		beta = dot[0] / rz;
+		rz = dot[0];
+		for(i = 0; i < n; i++)
+			own[i] = z[i] + beta*own[i];
+	}
+
+	free(r);
+	free(z);
+	free(q);
+	free(p);
+	return it;
+}
+
+int
+main(int argc, char *argv[])
+{
+	Csr *a;
+	double *x, *b, *ones;
+	double resid, err[1];
+	int64 start, end;
+	int dim = Ndim;
+	int nx, maxiter, niter, part, nparts, i;
+	double tol;
+
+	nx = N;
+	tol = 1e-8;
+	maxiter = -1;
+	if(argc > 1)
+		dim = strtol(argv[1], NULL, 10);
+	if(argc > 2)
+		nx = strtol(argv[2], NULL, 10);
+	if(argc > 3)
+		tol = strtod(argv[3], NULL);
+	if(argc > 4)
+		maxiter = strtol(argv[4], NULL, 10);
+	if(maxiter < 0)
+		maxiter = 10*nx;
+
+	if(dim < 0 || dim > 20){
+		printf("crazy dim %d (want 0 <= dim <= 20)\n", dim);
+		exit(1);
+	}
+	if(nx < (1 << dim)){
+		printf("grid %d is too small for cube dim %d\n", nx, dim);
+		exit(1);
+	}
+
+	initcube(dim);
+
+	nparts = 1 << cube_dim;
+	part = invgray(cube_id);
+	a = mkpoisson(nx, part, nparts);
+	halosetup(a, part, nparts);
+
+	/* right hand side for the all-ones solution */
+	ones = malloc((a->nleft + a->nrows + a->nright) * sizeof ones[0]);
+	for(i = 0; i < a->nleft + a->nrows + a->nright; i++)
+		ones[i] = 1.0;
+	b = malloc(a->nrows * sizeof b[0]);
+	x = malloc(a->nrows * sizeof x[0]);
+	spmv(a, b, ones);
+
+	/* line everybody up before starting the clock */
+	err[0] = 0.0;
+	cubeallreduce(err, 1, Rsum);
+
+	start = nsec();
+	niter = pcg(a, x, b, tol, maxiter, part, &resid);
+	end = nsec();
+
+	err[0] = 0.0;
+	for(i = 0; i < a->nrows; i++)
+		if(fabs(x[i] - 1.0) > err[0])
+			err[0] = fabs(x[i] - 1.0);
+	cubeallreduce(err, 1, Rmax);
+
+	if(cube_id == 0){
+		printf("cg: %lld unknowns on %d ranks, %d iterations, residual %.3g, max error %.3g\n",
+			a->n, nparts, niter, resid, err[0]);
+		printf("cg: %.3f ms/iteration, %.4f s to %s %g\n",
+			(end-start)*1e-6 / (niter > 0 ? niter : 1), (end-start)*1e-9,
+			resid < tol ? "tolerance" : "give up short of", tol);
+	}
+
+	endcube();
+
+	return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+#include "stripe.h"
+#include "ckpt.h"
+
+#include <glob.h>
+#include <limits.h>
+
+typedef struct Ckpthdr Ckpthdr;
+
+struct Ckpthdr {
+	char magic[8];
+	int nranks;
+	int id;
+	int nrows;
+	int ncols;
+	int layout;
+	int width;
+	int row;
+};
+
+static char ckptmagic[8] = "ckpt0\n";
+
+static void
+ckptname(Ckpt *c, int row, char *buf, int len)
+{
+	snprintf(buf, len, "%s.%d.%d", c->prefix, cube_id, row);
+}
+
+static void
+ckptremove(Ckpt *c, int row)
+{
+	char name[256];
+
+	if(row < 0)
+		return;
+	ckptname(c, row, name, sizeof name);
+	unlink(name);
+}
+
+static int
+writen(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	char *p;
+
+	for(p = buf; len > 0; p += n, len -= n){
+		n = write(fd, p, len);
+		if(n <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+readn(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	char *p;
+
+	for(p = buf; len > 0; p += n, len -= n){
+		n = read(fd, p, len);
+		if(n <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ *	runs in the forked writer, on the snapshot. the file only gets
+ *	its name once it is all on disk.
+ */
+static int
+ckptwrite(Ckpt *c, Stripe *s, int *piv, int row)
+{
+	Ckpthdr h;
+	char name[256], tmp[264];
+	int fd;
+
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, ckptmagic, sizeof h.magic);
+	h.nranks = cube_nranks;
+	h.id = cube_id;
+	h.nrows = s->nrows;
+	h.ncols = s->ncols;
+	h.layout = s->layout;
+	h.width = s->width;
+	h.row = row;
+
+	ckptname(c, row, name, sizeof name);
+	snprintf(tmp, sizeof tmp, "%s.tmp", name);
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd == -1){
+		fprintf(stderr, "%d: checkpoint '%s': %s\n", cube_id, tmp, strerror(errno));
+		return -1;
+	}
+	if(writen(fd, &h, sizeof h) == -1
+	|| writen(fd, piv, s->nrows * sizeof piv[0]) == -1
+	|| writen(fd, s->m, s->size * sizeof s->m[0]) == -1
+	|| fdatasync(fd) == -1){
+		fprintf(stderr, "%d: checkpoint '%s': %s\n", cube_id, tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp, name) == -1){
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	wait for the writer and agree over the cube on whether every
+ *	rank has the last checkpoint. the waitpid is by pid, so it
+ *	doesn't take a rank's child from endcube.
+ */
+static void
+ckptsync(Ckpt *c)
+{
+	double ok[1];
+	int st;
+
+	if(c->last < 0)
+		return;
+	ok[0] = 1.0;
+	if(c->writer > 0){
+		if(waitpid(c->writer, &st, 0) == -1 || !WIFEXITED(st) || WEXITSTATUS(st) != 0)
+			ok[0] = 0.0;
+	} else if(c->writer < 0){
+		ok[0] = 0.0;
+	}
+	c->writer = 0;
+	cubeallreduce(ok, 1, Rmin);
+	if(ok[0] == 1.0){
+		if(c->confirmed != c->last)
+			ckptremove(c, c->confirmed);
+		c->confirmed = c->last;
+	} else {
+		ckptremove(c, c->last);
+	}
+	c->last = c->confirmed;
+}
+
+void
+ckptinit(Ckpt *c, char *prefix, int every)
+{
+	memset(c, 0, sizeof c[0]);
+	c->prefix = prefix;
+	c->every = every;
+	c->last = -1;
+	c->confirmed = -1;
+}
+
+void
+ckptsave(Ckpt *c, Stripe *s, int *piv, int row)
+{
+	int64 start;
+	pid_t pid;
+
+	start = nsec();
+	ckptsync(c);
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if(pid == 0)
+		_exit(ckptwrite(c, s, piv, row) == 0 ? 0 : 1);
+	if(pid == -1)
+		fprintf(stderr, "%d: checkpoint fork: %s\n", cube_id, strerror(errno));
+	/* a failed fork still takes part, as a checkpoint that failed */
+	c->writer = pid;
+	c->last = row;
+	c->n++;
+	c->ns += nsec() - start;
+}
+
+/*
+ *	a finished run has no use for its checkpoints.
+ */
+void
+ckptdone(Ckpt *c)
+{
+	int64 start;
+
+	start = nsec();
+	ckptsync(c);
+	ckptremove(c, c->confirmed);
+	c->confirmed = c->last = -1;
+	c->ns += nsec() - start;
+}
+
+/*
+ *	1 for a checkpoint of this stripe at row, 0 for one that is
+ *	no good, -1 for a good one of a differently run solver.
+ */
+static int
+ckptok(Ckpt *c, Stripe *s, int row, int fd, Ckpthdr *h)
+{
+	if(readn(fd, h, sizeof h[0]) == -1)
+		return 0;
+	if(memcmp(h->magic, ckptmagic, sizeof h->magic) != 0 || h->row != row)
+		return 0;
+	if(h->nranks != cube_nranks || h->id != cube_id
+			|| h->nrows != s->nrows || h->ncols != s->ncols
+			|| h->layout != s->layout || h->width != s->width)
+		return -1;
+	return 1;
+}
+
+/*
+ *	the newest checkpoint that every rank has, by a few rounds of
+ *	allreduce-min over what each has on disk. returns the row to
+ *	go on from, 0 if there is none, and -1 if the checkpoints are
+ *	of a run with other ranks, size or layout, which are left be.
+ */
+int
+ckptload(Ckpt *c, Stripe *s, int *piv)
+{
+	Ckpthdr h;
+	glob_t g;
+	char pat[256], name[256];
+	double v[1];
+	int *rows, nrows, best, cand, i, fd, ok, hdr;
+
+	snprintf(pat, sizeof pat, "%s.%d.*", c->prefix, cube_id);
+	nrows = 0;
+	rows = NULL;
+	if(glob(pat, 0, NULL, &g) == 0){
+		rows = malloc(g.gl_pathc * sizeof rows[0]);
+		for(i = 0; i < (int)g.gl_pathc; i++){
+			char *p = strrchr(g.gl_pathv[i], '.') + 1, *e;
+			int r = strtol(p, &e, 10);
+			if(*e == '\0' && e != p)
+				rows[nrows++] = r;
+		}
+		globfree(&g);
+	}
+
+	/* a mismatch on any rank, even one with nothing to go on from */
+	hdr = 0;
+	for(i = 0; i < nrows && hdr != -1; i++){
+		ckptname(c, rows[i], name, sizeof name);
+		fd = open(name, O_RDONLY);
+		if(fd != -1){
+			hdr = ckptok(c, s, rows[i], fd, &h);
+			close(fd);
+		}
+	}
+	v[0] = hdr;
+	cubeallreduce(v, 1, Rmin);
+	if(v[0] == -1.0){
+		if(hdr == -1)
+			fprintf(stderr, "%d: %s is from %d ranks, %d rows, %s layout of width %d, not this run\n",
+				cube_id, name, h.nranks, h.nrows, stripename(h.layout), h.width);
+		free(rows);
+		return -1;
+	}
+
+	cand = INT_MAX;
+	ok = 0;
+	for(;;){
+		best = -1;
+		for(i = 0; i < nrows; i++)
+			if(rows[i] <= cand && rows[i] > best)
+				best = rows[i];
+		v[0] = best;
+		cubeallreduce(v, 1, Rmin);
+		cand = v[0];
+		if(cand < 0)
+			break;
+
+		ok = 0;
+		ckptname(c, cand, name, sizeof name);
+		fd = open(name, O_RDONLY);
+		if(fd != -1){
+			ok = ckptok(c, s, cand, fd, &h) == 1
+				&& readn(fd, piv, s->nrows * sizeof piv[0]) == 0
+				&& readn(fd, s->m, s->size * sizeof s->m[0]) == 0;
+			close(fd);
+		}
+		v[0] = ok;
+		cubeallreduce(v, 1, Rmin);
+		if(v[0] == 1.0)
+			break;
+		cand--;
+	}
+
+	/* only once one is in: the newer never made it to every rank */
+	if(cand < 0){
+		free(rows);
+		return 0;
+	}
+	for(i = 0; i < nrows; i++)
+		if(rows[i] != cand)
+			ckptremove(c, rows[i]);
+	free(rows);
+	c->last = c->confirmed = cand;
+	return cand;
+}
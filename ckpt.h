@@ -0,0 +1,45 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Ckpt Ckpt;
+
+/*
+ *	coordinated checkpoints of a stripe factorization. every
+ *	every rows each rank forks a writer that saves its stripe,
+ *	pivot history and row from the copy-on-write snapshot, while
+ *	the solver goes on. a checkpoint counts once every rank has
+ *	finished it, which is checked over the cube at the next one,
+ *	and only then is the one before removed.
+ */
+struct Ckpt {
+	char *prefix;
+	int every;
+	int last;	/* row of the checkpoint being written */
+	int confirmed;	/* row of the newest one complete on all ranks */
+	pid_t writer;
+	int n;
+	int64 ns;	/* time the solver spent on them */
+};
+
+void ckptinit(Ckpt *c, char *prefix, int every);
+void ckptsave(Ckpt *c, Stripe *s, int *piv, int row);
+int ckptload(Ckpt *c, Stripe *s, int *piv);
+void ckptdone(Ckpt *c);
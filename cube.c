@@ -20,6 +20,7 @@
  *	THE SOFTWARE.
  */
 #include "os.h"
+#include "cube.h"
 
 
 typedef struct Cubehdr Cubehdr;
@@ -41,19 +42,33 @@ struct Cubehdr {
 
 enum {
 	Flast = 1,
+	Npipe = 1024*1024,
+};
+
+char *cube_transports[Ntransport] = {
+	[Tunix] = "unix",
+	[Tfifo] = "fifo",
 };
 
 static const struct timeval cube_tick = { 0, 100*1000 };
-static int cube_fd[32];
+static int cube_rfd[32];
+static int cube_wfd[32];
+static int cube_transport = -1;
+static int cube_frag;
+static int cube_ncpu = 1;
 static Cubeconn *cube_conn;
-uint32 cube_id;
-uint32 cube_mask;
+int cube_id;
+int cube_mask;
 int cube_dim;
+int cube_nranks;
 
+/*
+ *	a read or write timed out. ranks of a long running service sit
+ *	in reads between jobs, so this stays quiet.
+ */
 static void
 cubetick(void)
 {
-	printf("%d: cubetick\n", cube_id);
 	// retrasnmit una packets
 }
 
@@ -72,7 +87,7 @@ process_ack(Cubehdr *hdr)
 }
 
 static int
-fdfork(int fd, int post)
+sockfork(int rfd, int wfd, int post, int *nfd)
 {
 	static int seq;
 	struct sockaddr_un sa;
@@ -99,7 +114,7 @@ fdfork(int fd, int post)
 			fprintf(stderr, "listen: %s\n", strerror(errno));
 			goto err_out;
 		}
-		if(write(fd, sa.sun_path, len) != len){
+		if(write(wfd, sa.sun_path, len) != len){
 			fprintf(stderr, "write '%s': %s\n", sa.sun_path, strerror(errno));
 			goto err_out;
 		}
@@ -110,7 +125,7 @@ fdfork(int fd, int post)
 			goto err_out;
 		}
 
-		len = read(fd, buf, len);
+		len = read(rfd, buf, len);
 		if(len <= 0){
 			fprintf(stderr, "read: %s\n", strerror(errno));
 			goto err_out;
@@ -127,7 +142,7 @@ fdfork(int fd, int post)
 		newfd = socket(PF_UNIX, SOCK_STREAM, 0);
 		memset(&sa, 0, sizeof sa);
 		sa.sun_family = AF_UNIX;
-		len = read(fd, sa.sun_path, sizeof sa.sun_path-1);
+		len = read(rfd, sa.sun_path, sizeof sa.sun_path-1);
 		if(len <= 0){
 			fprintf(stderr, "read: %s\n", strerror(errno));
 			goto err_out;
@@ -136,7 +151,7 @@ fdfork(int fd, int post)
 			fprintf(stderr, "connect '%s': %s\n", sa.sun_path, strerror(errno));
 			goto err_out;
 		}
-		if(write(fd, sa.sun_path, len) != len)
+		if(write(wfd, sa.sun_path, len) != len)
 			goto err_out;
 	}
 #if 1
@@ -145,50 +160,206 @@ fdfork(int fd, int post)
 	if(setsockopt(newfd, SOL_SOCKET, SO_RCVTIMEO, &cube_tick, sizeof cube_tick) == -1)
 		goto err_out;
 #endif
-	return newfd;
+	*nfd = newfd;
+	return 0;
 
 err_out:
 	if(lfd != -1)
 		close(lfd);
 	if(newfd != -1)
 		close(newfd);
-	fprintf(stderr, "fdfork: fail\n");
+	fprintf(stderr, "sockfork: fail\n");
 	return -1;
 }
 
+/*
+ *	the fifo link from the old hcube.c, with one fifo per direction
+ *	since a single one would hand a rank back its own writes. both
+ *	are opened O_RDWR so that neither open waits for the other end.
+ */
+static int
+fifoopen(char *path, int *fd)
+{
+	*fd = open(path, O_RDWR);
+	if(*fd == -1){
+		fprintf(stderr, "open '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	fcntl(*fd, F_SETPIPE_SZ, Npipe);
+	return 0;
+}
+
 static int
-hyperfork(int *fd, int id, int dim)
+fifofork(int rfd, int wfd, int post, int *nrfd, int *nwfd)
 {
-	int chfd[dim];
-	int ch[2];
+	static int seq;
+	char path[64], p0[80], p1[80];
+	char buf[64];
+	int len;
+
+	*nrfd = -1;
+	*nwfd = -1;
+	if(post){
+		len = snprintf(path, sizeof path, "cubefifo.%d.%d", getpid(), seq++);
+		snprintf(p0, sizeof p0, "%s.0", path);
+		snprintf(p1, sizeof p1, "%s.1", path);
+		if(mkfifo(p0, 0600) == -1 || mkfifo(p1, 0600) == -1){
+			fprintf(stderr, "mkfifo '%s': %s\n", path, strerror(errno));
+			goto err_out;
+		}
+		if(fifoopen(p0, nwfd) == -1 || fifoopen(p1, nrfd) == -1)
+			goto err_out;
+		if(write(wfd, path, len) != len){
+			fprintf(stderr, "write '%s': %s\n", path, strerror(errno));
+			goto err_out;
+		}
+		len = read(rfd, buf, sizeof buf-1);
+		if(len <= 0){
+			fprintf(stderr, "read: %s\n", strerror(errno));
+			goto err_out;
+		}
+		buf[len] = '\0';
+		if(strcmp(path, buf)){
+			fprintf(stderr, "read: got '%s' wanted '%s'\n", buf, path);
+			goto err_out;
+		}
+		unlink(p0);
+		unlink(p1);
+	} else {
+		len = read(rfd, path, sizeof path-1);
+		if(len <= 0){
+			fprintf(stderr, "read: %s\n", strerror(errno));
+			goto err_out;
+		}
+		path[len] = '\0';
+		snprintf(p0, sizeof p0, "%s.0", path);
+		snprintf(p1, sizeof p1, "%s.1", path);
+		if(fifoopen(p0, nrfd) == -1 || fifoopen(p1, nwfd) == -1)
+			goto err_out;
+		if(write(wfd, path, len) != len)
+			goto err_out;
+	}
+	return 0;
+
+err_out:
+	if(*nrfd != -1)
+		close(*nrfd);
+	if(*nwfd != -1)
+		close(*nwfd);
+	fprintf(stderr, "fifofork: fail\n");
+	return -1;
+}
+
+static int
+linkfork(int rfd, int wfd, int post, int *nrfd, int *nwfd)
+{
+	switch(cube_transport){
+	case Tfifo:
+		return fifofork(rfd, wfd, post, nrfd, nwfd);
+	default:
+		if(sockfork(rfd, wfd, post, nrfd) == -1)
+			return -1;
+		*nwfd = *nrfd;
+		return 0;
+	}
+}
+
+/*
+ *	the link between a parent and the child it forks, made before
+ *	the fork: a socketpair, or a pipe each way for fifos.
+ */
+static int
+linkpair(int *prfd, int *pwfd, int *crfd, int *cwfd)
+{
+	int p0[2], p1[2];
+
+	switch(cube_transport){
+	case Tfifo:
+		if(pipe(p0) == -1)
+			return -1;
+		if(pipe(p1) == -1){
+			close(p0[0]);
+			close(p0[1]);
+			return -1;
+		}
+		fcntl(p0[1], F_SETPIPE_SZ, Npipe);
+		fcntl(p1[1], F_SETPIPE_SZ, Npipe);
+		*prfd = p0[0];
+		*cwfd = p0[1];
+		*crfd = p1[0];
+		*pwfd = p1[1];
+		return 0;
+	default:
+		if(socketpair(PF_LOCAL, SOCK_STREAM, 0, p0) == -1)
+			return -1;
+		*prfd = *pwfd = p0[0];
+		*crfd = *cwfd = p0[1];
+		return 0;
+	}
+}
+
+static void
+linkclose(int rfd, int wfd)
+{
+	if(rfd == -1)
+		return;
+	close(rfd);
+	if(wfd != rfd)
+		close(wfd);
+}
+
+/*
+ *	in a cube of n ranks that isn't a power of two, the children
+ *	that would get an id of n or more are never forked, and links
+ *	to them are left at -1. both ends of a link see the same ids,
+ *	so they agree on which rendezvous to skip.
+ */
+static int
+hyperfork(int *rfd, int *wfd, int id, int dim, int n)
+{
+	int chrfd[dim], chwfd[dim];
+	int prfd, pwfd, crfd, cwfd;
 	int i;
 
+	if((id | 1<<dim) >= n){
+		rfd[dim] = -1;
+		wfd[dim] = -1;
+		return id;
+	}
 	for(i = 0; i < dim; i++){
-		chfd[i] = fdfork(fd[i], (id & (1<<i)) == 0);
-		if(chfd[i] == -1){
-			fprintf(stderr, "fdfork %d/%d bad\n", i, dim);
+		chrfd[i] = chwfd[i] = -1;
+		if(((id ^ 1<<i) | 1<<dim) >= n)
+			continue;
+		if(linkfork(rfd[i], wfd[i], (id & (1<<i)) == 0, chrfd+i, chwfd+i) == -1){
+			fprintf(stderr, "linkfork %d/%d bad\n", i, dim);
 			return -1;
 		}
 	}
-	socketpair(PF_LOCAL, SOCK_STREAM, 0, ch);
+	if(linkpair(&prfd, &pwfd, &crfd, &cwfd) == -1){
+		fprintf(stderr, "linkpair: %s\n", strerror(errno));
+		return -1;
+	}
 	switch(fork()){
 	case -1:
 		fprintf(stderr, "fork() %s:", strerror(errno));
 		return -1;
 	case 0:
 		for(i = 0; i < dim; i++){
-			close(fd[i]);
-			fd[i] = chfd[i];
+			linkclose(rfd[i], wfd[i]);
+			rfd[i] = chrfd[i];
+			wfd[i] = chwfd[i];
 		}
 		id |= 1 << dim;
-		close(ch[0]);
-		fd[dim] = ch[1];
+		linkclose(prfd, pwfd);
+		rfd[dim] = crfd;
+		wfd[dim] = cwfd;
 		break;
 	default:
 		for(i = 0; i < dim; i++)
-			close(chfd[i]);
-		close(ch[1]);
-		fd[dim] = ch[0];
+			linkclose(chrfd[i], chwfd[i]);
+		linkclose(crfd, cwfd);
+		rfd[dim] = prfd;
+		wfd[dim] = pwfd;
 		break;
 	}
 	return id;
@@ -215,7 +386,7 @@ readvn(int dim, struct iovec *xiov, int niov)
 	iov = tiov;
 	totrd = 0;
 	for(;;){
-		nrd = readv(cube_fd[dim], iov, niov);
+		nrd = readv(cube_rfd[dim], iov, niov);
 		if(nrd == (size_t)-1){
 			if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS)){
 				cubetick();
@@ -279,7 +450,7 @@ writevn(int dim, struct iovec *xiov, int niov)
 	iov = tiov;
 	totwr = 0;
 	for(;;){
-		nwr = writev(cube_fd[dim], iov, niov);
+		nwr = writev(cube_wfd[dim], iov, niov);
 		if(nwr == (size_t)-1){
 			if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS)){
 				cubetick();
@@ -303,12 +474,64 @@ fprintf(stderr, "partial writev\n");
 	return totwr;
 }
 
-int
-cubebroadcast(int srcid, struct iovec *iov, int niov)
+/*
+ *	a rank is on the way up from src to rank 0 if it is src with
+ *	some of the low bits cleared.
+ */
+static int
+onpath(int srcid, int id)
+{
+	if(id == 0)
+		return 1;
+	return ((srcid ^ id) >> __builtin_ctz(id)) == 0;
+}
+
+/*
+ *	the xor tree below needs every rank to exist. in an incomplete
+ *	cube the data goes along the binomial tree rooted at rank 0,
+ *	where every parent id is smaller than its child's and so is
+ *	there. the edges from src up to 0 are turned around, so src
+ *	sends up its path and down its subtree at once: every rank
+ *	reads once from upstream before it writes, which keeps it
+ *	deadlock free, and no rank is more than 2*dim hops from src.
+ */
+static int
+pathbroadcast(int srcid, struct iovec *iov, int niov)
+{
+	int dim, up, c, top;
+	int nrd, nwr;
+
+	nrd = nwr = 0;
+	if(cube_id != srcid){
+		if(onpath(srcid, cube_id)){
+			/* read from the rank below us on the path */
+			for(c = srcid; (c ^ (c & -c)) != cube_id; c ^= c & -c)
+				;
+			up = c;
+		} else {
+			up = cube_id ^ (cube_id & -cube_id);
+		}
+		nrd = readvn(__builtin_ctz(cube_id ^ up), iov, niov);
+	}
+	if(cube_id != 0 && onpath(srcid, cube_id))
+		nwr = writevn(__builtin_ctz(cube_id), iov, niov);
+	top = cube_id == 0 ? cube_dim : __builtin_ctz(cube_id);
+	for(dim = top-1; dim >= 0; dim--){
+		c = cube_id | 1<<dim;
+		if(c < cube_nranks && !onpath(srcid, c))
+			nwr = writevn(dim, iov, niov);
+	}
+	return cube_id == srcid ? nwr : nrd;
+}
+
+static int
+treebroadcast(int srcid, struct iovec *iov, int niov)
 {
 	int virtid, dim, mask;
 	int nrd, nwr;
 
+	if(cube_nranks != 1<<cube_dim)
+		return pathbroadcast(srcid, iov, niov);
 	nrd = nwr = 0;
 	virtid = srcid ^ cube_id;
 	mask = cube_mask;
@@ -325,29 +548,260 @@ cubebroadcast(int srcid, struct iovec *iov, int niov)
 	return virtid == 0 ? nwr : nrd;
 }
 
+/*
+ *	bytes off .. off+len of iov as a list of its own in sub,
+ *	which has room for niov entries. returns the count.
+ */
+static int
+slice(struct iovec *iov, int niov, size_t off, size_t len, struct iovec *sub)
+{
+	size_t n;
+	int i, ns;
+
+	ns = 0;
+	for(i = 0; i < niov && len > 0; i++){
+		if(off >= iov[i].iov_len){
+			off -= iov[i].iov_len;
+			continue;
+		}
+		n = iov[i].iov_len - off;
+		if(n > len)
+			n = len;
+		sub[ns].iov_base = (char*)iov[i].iov_base + off;
+		sub[ns].iov_len = n;
+		ns++;
+		len -= n;
+		off = 0;
+	}
+	return ns;
+}
+
+/*
+ *	with a fragment size set, a long message goes down the tree
+ *	in pieces of that size, so the ranks in the middle forward
+ *	the first piece while the source is still writing the next.
+ */
 int
-initcube(int dim)
+cubebroadcast(int srcid, struct iovec *iov, int niov)
+{
+	struct iovec sub[niov];
+	size_t off, len, total;
+	int i, n;
+
+	total = 0;
+	for(i = 0; i < niov; i++)
+		total += iov[i].iov_len;
+	if(cube_frag <= 0 || total <= (size_t)cube_frag)
+		return treebroadcast(srcid, iov, niov);
+	n = 0;
+	for(off = 0; off < total; off += len){
+		len = total - off;
+		if(len > (size_t)cube_frag)
+			len = cube_frag;
+		n += treebroadcast(srcid, sub, slice(iov, niov, off, len, sub));
+	}
+	return n;
+}
+
+/*
+ *	point to point traffic over a single link. both ends of an
+ *	exchange call it with the same dim; the end with the bit clear
+ *	writes first so that two large messages can't deadlock.
+ */
+int
+cubesend(int dim, struct iovec *iov, int niov)
+{
+	return writevn(dim, iov, niov);
+}
+
+int
+cuberecv(int dim, struct iovec *iov, int niov)
+{
+	return readvn(dim, iov, niov);
+}
+
+int
+cubeexchange(int dim, struct iovec *out, int nout, struct iovec *in, int nin)
+{
+	int nrd;
+
+	if((cube_id & (1<<dim)) == 0){
+		writevn(dim, out, nout);
+		nrd = readvn(dim, in, nin);
+	} else {
+		nrd = readvn(dim, in, nin);
+		writevn(dim, out, nout);
+	}
+	return nrd;
+}
+
+/*
+ *	recursive doubling over all dimensions, every rank ends up
+ *	with the same result in v. an incomplete cube has ranks with
+ *	no partner, so there it reduces up the tree to rank 0 and
+ *	broadcasts the result back down.
+ */
+static void
+reduce(double *v, double *t, int n, int op)
 {
 	int i;
 
+	switch(op){
+	case Rsum:
+		for(i = 0; i < n; i++)
+			v[i] += t[i];
+		break;
+	case Rmax:
+		for(i = 0; i < n; i++)
+			if(t[i] > v[i])
+				v[i] = t[i];
+		break;
+	case Rmin:
+		for(i = 0; i < n; i++)
+			if(t[i] < v[i])
+				v[i] = t[i];
+		break;
+	}
+}
+
+int
+cubeallreduce(double *v, int n, int op)
+{
+	double tbuf[64], *t;
+	int dim, top;
+
+	t = n <= nelem(tbuf) ? tbuf : malloc(n * sizeof t[0]);
+	if(t == NULL){
+		fprintf(stderr, "cube %d: cubeallreduce: cannot allocate %d values\n", cube_id, n);
+		exit(1);
+	}
+	if(cube_nranks != 1<<cube_dim){
+		top = cube_id == 0 ? cube_dim : __builtin_ctz(cube_id);
+		for(dim = 0; dim < top; dim++){
+			if((cube_id | 1<<dim) >= cube_nranks)
+				continue;
+			readvn(dim, (struct iovec[]){{t, n * sizeof t[0]}}, 1);
+			reduce(v, t, n, op);
+		}
+		if(cube_id != 0)
+			writevn(top, (struct iovec[]){{v, n * sizeof v[0]}}, 1);
+		pathbroadcast(0, (struct iovec[]){{v, n * sizeof v[0]}}, 1);
+	} else {
+		for(dim = 0; dim < cube_dim; dim++){
+			cubeexchange(
+				dim,
+				(struct iovec[]){{v, n * sizeof v[0]}}, 1,
+				(struct iovec[]){{t, n * sizeof t[0]}}, 1
+			);
+			reduce(v, t, n, op);
+		}
+	}
+	if(t != tbuf)
+		free(t);
+	return n;
+}
+
+/*
+ *	pick the link implementation for the next initcube, by name.
+ *	without it initcube goes by $CUBELINK, and unix sockets. a nil
+ *	name just returns the one in use.
+ */
+int
+cubetransport(char *name)
+{
+	int i;
+
+	if(name == NULL)
+		return cube_transport;
+	for(i = 0; i < Ntransport; i++){
+		if(strcmp(cube_transports[i], name) == 0){
+			cube_transport = i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ *	the largest piece a broadcast is sent in from now on, zero
+ *	for whole messages. returns the old one.
+ */
+int
+cubefragment(int size)
+{
+	int old;
+
+	old = cube_frag;
+	cube_frag = size > 0 ? size : 0;
+	return old;
+}
+
+/*
+ *	cpus each rank of the next initcube gets for its threads,
+ *	rank i the ones from i*n up.
+ */
+int
+cubecpus(int n)
+{
+	int old;
+
+	old = cube_ncpu;
+	cube_ncpu = n > 0 ? n : 1;
+	return old;
+}
+
+/*
+ *	n ranks, which need not be a power of two: the cube is the
+ *	smallest one that holds them, with the ids from n up missing.
+ */
+int
+initcuben(int n)
+{
+	char *s;
+	int i, dim;
+
+	if(cube_transport == -1){
+		s = getenv("CUBELINK");
+		if(s == NULL || cubetransport(s) == -1)
+			cube_transport = Tunix;
+	}
+
+	for(dim = 0; (1<<dim) < n; dim++)
+		;
 	cube_id = 0;
 	cube_dim = dim;
+	cube_nranks = n;
 	cube_mask = (1<<dim) - 1;
 	cube_conn = malloc((1u<<dim) * sizeof cube_conn[0]);
 	memset(cube_conn, 0, (1u<<dim) * sizeof cube_conn[0]);
 	for(i = 0; i < dim; i++)
-		cube_id = hyperfork(cube_fd, cube_id, i);
+		cube_id = hyperfork(cube_rfd, cube_wfd, cube_id, i, n);
 
 	cpu_set_t my_set;        /* Define your cpu_set bit mask. */
 	CPU_ZERO(&my_set);       /* Initialize it all to 0, i.e. no CPUs selected. */
 
+	/* the swizzle only permutes whole groups of 16, the tail stays put */
 	int id = (cube_id & ~15) | ((cube_id&15)>>1) | ((cube_id&1)<<3);
-	CPU_SET(id, &my_set);     /* set the bit that represents this core */
-	sched_setaffinity(0, sizeof(cpu_set_t), &my_set); /* Set affinity of tihs process to */
+	if((cube_id | 15) >= n || cube_ncpu > 1)
+		id = cube_id;
+	/* more ranks and threads than cpus go round them again */
+	int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if(ncpu < 1 || ncpu > CPU_SETSIZE)
+		ncpu = CPU_SETSIZE;
+	for(i = 0; i < cube_ncpu; i++)
+		CPU_SET((id*cube_ncpu + i) % ncpu, &my_set);     /* set the bit that represents this core */
+	if(sched_setaffinity(0, sizeof(cpu_set_t), &my_set) == -1) /* Set affinity of tihs process to */
+		fprintf(stderr, "cube %d: sched_setaffinity: %s\n", cube_id, strerror(errno));
        
 	return cube_id;
 }
 
+int
+initcube(int dim)
+{
+	return initcuben(1<<dim);
+}
+
 int
 endcube(void)
 {
@@ -355,7 +809,8 @@ endcube(void)
 	for(i = cube_dim-1; i >= 0; i--){
 		if((cube_id & (1<<i)) != 0)
 			break;
-		waitpid(-1, NULL, 0);
+		if((cube_id | 1<<i) < cube_nranks)
+			waitpid(-1, NULL, 0);
 	}
 	exit(0);
 }
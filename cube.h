@@ -19,11 +19,33 @@
  *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *	THE SOFTWARE.
  */
+enum {
+	Rsum,
+	Rmax,
+	Rmin,
+};
+
+enum {
+	Tunix,
+	Tfifo,
+	Ntransport,
+};
+
 int cubebroadcast(int srcid, struct iovec *iov, int niov);
+int cubesend(int dim, struct iovec *iov, int niov);
+int cuberecv(int dim, struct iovec *iov, int niov);
+int cubeexchange(int dim, struct iovec *out, int nout, struct iovec *in, int nin);
+int cubeallreduce(double *v, int n, int op);
+int cubetransport(char *name);
+int cubefragment(int size);
+int cubecpus(int n);
 int initcube(int dim);
+int initcuben(int n);
 int endcube(void);
 
 extern int cube_id;
 extern int cube_dim;
 extern int cube_mask;
-extern int cube_round;
\ No newline at end of file
+extern int cube_nranks;
+extern int cube_round;
+extern char *cube_transports[Ntransport];
\ No newline at end of file
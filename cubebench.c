@@ -0,0 +1,325 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+
+enum {
+	Ndim = 3,
+	Nreps = 20,
+	Nwarm = 2,
+	Nmin = 8,
+	Nmax = 64*1024*1024,
+	Nping = 8,		/* ping-pong message */
+	Nstream = 1024*1024,	/* streaming message */
+	Nbytes = 256*1024*1024,	/* how much a size gets to move */
+};
+
+static int csv;
+
+static int
+cmp64(const void *ap, const void *bp)
+{
+	int64 a, b;
+	a = *(int64 *)ap;
+	b = *(int64 *)bp;
+	if(a < b)
+		return -1;
+	else if(a > b)
+		return 1;
+	return 0;
+}
+
+/*
+ *	one line per test, link implementation, dim and message size,
+ *	with the median time of a single message and what that makes
+ *	in bandwidth.
+ */
+static void
+report(char *test, int dim, int64 size, int64 *t, int reps)
+{
+	int64 tmin, tmed;
+
+	qsort(t, reps, sizeof t[0], cmp64);
+	tmin = t[0];
+	tmed = t[reps/2];
+	if(csv){
+		printf("%s,%s,%d,%lld,%d,%.9f,%.9f,%.3f\n", test, cube_transports[cubetransport(NULL)],
+			dim, size, reps, tmin*1e-9, tmed*1e-9, size / (tmed*1e-3));
+	} else {
+		printf("%-9s %-5s dim %2d %10lld B  min %10.3f us  med %10.3f us  %10.1f MB/s\n",
+			test, cube_transports[cubetransport(NULL)], dim, size,
+			tmin*1e-3, tmed*1e-3, size / (tmed*1e-3));
+	}
+	fflush(stdout);
+}
+
+static void
+barrier(void)
+{
+	double t[1];
+
+	t[0] = 0.0;
+	cubeallreduce(t, 1, Rsum);
+}
+
+/*
+ *	every pair of ranks across link d bounces a small message back
+ *	and forth at once, as they would in a cube algorithm. half the
+ *	round trip is the latency.
+ */
+static void
+pingpong(int d, char *buf, int warm, int reps)
+{
+	int64 times[reps];
+	int64 start;
+	int r;
+
+	barrier();
+	for(r = -warm; r < reps; r++){
+		start = nsec();
+		if((cube_id & (1<<d)) == 0){
+			cubesend(d, (struct iovec[]){{buf, Nping}}, 1);
+			cuberecv(d, (struct iovec[]){{buf, Nping}}, 1);
+		} else {
+			cuberecv(d, (struct iovec[]){{buf, Nping}}, 1);
+			cubesend(d, (struct iovec[]){{buf, Nping}}, 1);
+		}
+		if(r >= 0)
+			times[r] = (nsec() - start) / 2;
+	}
+	if(cube_id == 0)
+		report("pingpong", d, Nping, times, reps);
+}
+
+/*
+ *	one way traffic over link d, the low end sending back to back
+ *	messages and the high end answering the last one of each rep.
+ */
+static void
+stream(int d, char *buf, int warm, int reps)
+{
+	int64 times[reps];
+	int64 start;
+	int r, i, nmsg;
+
+	nmsg = Nbytes / Nstream / (reps+warm);
+	if(nmsg < 4)
+		nmsg = 4;
+	barrier();
+	for(r = -warm; r < reps; r++){
+		start = nsec();
+		if((cube_id & (1<<d)) == 0){
+			for(i = 0; i < nmsg; i++)
+				cubesend(d, (struct iovec[]){{buf, Nstream}}, 1);
+			cuberecv(d, (struct iovec[]){{buf, Nping}}, 1);
+		} else {
+			for(i = 0; i < nmsg; i++)
+				cuberecv(d, (struct iovec[]){{buf, Nstream}}, 1);
+			cubesend(d, (struct iovec[]){{buf, Nping}}, 1);
+		}
+		if(r >= 0)
+			times[r] = (nsec() - start) / nmsg;
+	}
+	if(cube_id == 0)
+		report("stream", d, Nstream, times, reps);
+}
+
+/*
+ *	a broadcast is done when the slowest rank has its copy, so
+ *	each rep starts from a barrier and takes the max over ranks.
+ */
+static void
+broadcast(char *buf, int64 size, int warm, int reps)
+{
+	int64 times[reps];
+	double t[1];
+	int64 start;
+	int r;
+
+	for(r = -warm; r < reps; r++){
+		barrier();
+		start = nsec();
+		cubebroadcast(0, (struct iovec[]){{buf, size}}, 1);
+		t[0] = nsec() - start;
+		cubeallreduce(t, 1, Rmax);
+		if(r >= 0)
+			times[r] = t[0];
+	}
+	if(cube_id == 0)
+		report("broadcast", cube_dim, size, times, reps);
+}
+
+/*
+ *	runs in a child of its own, since initcube forks the ranks
+ *	and endcube exits. the link tests go over the newest link,
+ *	so a sweep of dims covers every link once.
+ */
+static void
+bench(int dim, int64 nmin, int64 nmax, int warm, int reps)
+{
+	char *buf;
+	int64 size;
+	int n;
+
+	initcube(dim);
+
+	/* after initcube, so the buffer is first touched by its rank */
+	buf = hugealloc(nmax > Nstream ? nmax : Nstream);
+	if(buf == NULL){
+		fprintf(stderr, "%3d: cannot allocate %lld bytes\n", cube_id, nmax);
+		exit(1);
+	}
+
+	if(dim > 0){
+		pingpong(dim-1, buf, warm, reps);
+		stream(dim-1, buf, warm, reps);
+	}
+	for(size = nmin;; size *= 4){
+		if(size > nmax)
+			size = nmax;
+		n = Nbytes / size;
+		if(n > reps)
+			n = reps;
+		if(n < 3)
+			n = 3;
+		broadcast(buf, size, n < warm ? n : warm, n);
+		if(size == nmax)
+			break;
+	}
+
+	endcube();
+}
+
+static int64
+parsesize(char *s, char **rp)
+{
+	char *r;
+	int64 n;
+
+	n = strtoll(s, &r, 10);
+	switch(*r){
+	case 'k': case 'K':
+		n *= 1024;
+		r++;
+		break;
+	case 'm': case 'M':
+		n *= 1024*1024;
+		r++;
+		break;
+	}
+	if(rp != NULL)
+		*rp = r;
+	return n;
+}
+
+static void
+usage(void)
+{
+	int i;
+
+	fprintf(stderr, "usage: cubebench [-c] [-r reps] [-w warmup] [-t links] [-d maxdim] [size | min-max]\n");
+	fprintf(stderr, "links:");
+	for(i = 0; i < Ntransport; i++)
+		fprintf(stderr, " %s", cube_transports[i]);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int64 nmin, nmax;
+	char *r, *tlist, *p, *q;
+	int reps, warm, opt;
+	int dim, maxdim;
+	pid_t pid;
+
+	nmin = Nmin;
+	nmax = Nmax;
+	reps = Nreps;
+	warm = Nwarm;
+	maxdim = Ndim;
+	tlist = NULL;
+	while((opt = getopt(argc, argv, "cr:w:t:d:")) != -1){
+		switch(opt){
+		case 'c':
+			csv = 1;
+			break;
+		case 'r':
+			reps = strtol(optarg, NULL, 10);
+			break;
+		case 'w':
+			warm = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			tlist = optarg;
+			break;
+		case 'd':
+			maxdim = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc > 0){
+		nmin = nmax = parsesize(argv[0], &r);
+		if(*r == '-')
+			nmax = parsesize(r+1, NULL);
+	}
+	if(reps < 1 || warm < 0 || nmin < 1 || nmax < nmin || maxdim < 0 || maxdim > 20)
+		usage();
+
+	if(tlist == NULL){
+		tlist = malloc(16 * Ntransport);
+		tlist[0] = '\0';
+		for(dim = 0; dim < Ntransport; dim++)
+			sprintf(tlist + strlen(tlist), "%s%s", dim > 0 ? "," : "", cube_transports[dim]);
+	}
+
+	if(csv)
+		printf("test,link,dim,size,reps,min_s,median_s,mb_per_s\n");
+
+	p = strdup(tlist);
+	q = p;
+	while(q != NULL){
+		r = strsep(&q, ",");
+		if(cubetransport(r) == -1){
+			fprintf(stderr, "unknown link '%s'\n", r);
+			usage();
+		}
+		for(dim = 0; dim <= maxdim; dim++){
+			fflush(stdout);
+			pid = fork();
+			if(pid == -1){
+				fprintf(stderr, "fork: %s\n", strerror(errno));
+				break;
+			}
+			if(pid == 0)
+				bench(dim, nmin, nmax, warm, reps);
+			waitpid(pid, NULL, 0);
+		}
+	}
+	free(p);
+	return 0;
+}
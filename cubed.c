@@ -0,0 +1,641 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+#include "stripe.h"
+#include "sortlib.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+
+/*
+ *	a cube that stays up between jobs. rank 0 takes jobs from
+ *	clients on a unix socket, collects whatever is queued into a
+ *	batch and broadcasts the descriptors; every rank then maps the
+ *	job file and works on its own columns in place, in a stripe
+ *	that is kept from one job to the next.
+ *
+ *	job files hold doubles row-major:
+ *
+ *	factor	a[n*n], then int32 ipiv[n]	a = p*l*u, l and u in a
+ *	solve	a[n*n], then b[n*nrhs]		x replaces b
+ *	invert	a[n*n]				inverse replaces a
+ *	sort	int32 keys[n]			sorted in place
+ */
+
+enum {
+	Ofactor,
+	Osolve,
+	Oinvert,
+	Osort,
+	Oquit,
+
+	Nbatch = 16,
+	Npath = 256,
+	Nwait = 1000,	/* ms a client gets to send its job */
+	Nmax = 1<<20,	/* largest n, so sizes can't overflow */
+};
+
+enum {
+	Sok,
+	Sbad,
+	Ssingular,
+};
+
+typedef struct Job Job;
+typedef struct Batch Batch;
+typedef struct Reply Reply;
+
+struct Job {
+	int op;
+	int n;
+	int nrhs;
+	char path[Npath];
+};
+
+struct Batch {
+	int njob;
+	Job job[Nbatch];
+};
+
+/* to the client, after its job is done on every rank */
+struct Reply {
+	int status;
+	int64 wait;
+	int64 run;
+};
+
+static char *opname[] = {
+	[Ofactor] = "factor",
+	[Osolve] = "solve",
+	[Oinvert] = "invert",
+	[Osort] = "sort",
+	[Oquit] = "quit",
+};
+
+static char *statname[] = {
+	[Sok] = "ok",
+	[Sbad] = "bad job",
+	[Ssingular] = "singular",
+};
+
+static Stripe *warm;
+static int *keys;
+static int64 nkeys;
+static int layout = Lpanel;
+static int width = Npanel;
+
+static void
+swap(double *p, double *q, int n)
+{
+	double t;
+	int i;
+	for(i = 0; i < n; i++){
+		t = p[i];
+		p[i] = q[i];
+		q[i] = t;
+	}
+}
+
+static void
+swaprows(Stripe *s, int p, int q)
+{
+	double *c;
+	int j, je;
+	for(j = 0; j < s->ncols; j = je){
+		je = striperun(s, j);
+		c = stripecol(s, j);
+		swap(c + (size_t)p*s->stride, c + (size_t)q*s->stride, je-j);
+	}
+}
+
+/* local index of the first column of ours at global index g or up */
+static int
+firstcol(int g)
+{
+	int j;
+
+	j = g / cube_nranks;
+	if(g % cube_nranks > cube_id)
+		j++;
+	return j;
+}
+
+/* anything else is turned away before it gets to the ranks */
+static int
+jobok(Job *j)
+{
+	if(j->op < 0 || j->op >= nelem(opname))
+		return 0;
+	if(j->op == Oquit)
+		return 1;
+	if(j->n <= 0 || j->n > Nmax)
+		return 0;
+	if(j->op == Osolve && (j->nrhs <= 0 || j->nrhs > j->n))
+		return 0;
+	return 1;
+}
+
+static int
+opsize(Job *j, size_t *size)
+{
+	size_t n;
+
+	if(!jobok(j))
+		return -1;
+	n = j->n;
+	switch(j->op){
+	case Ofactor:
+		*size = n*n*sizeof(double) + n*sizeof(int32);
+		return 0;
+	case Osolve:
+		if(j->nrhs <= 0)
+			return -1;
+		*size = n*(n+j->nrhs)*sizeof(double);
+		return 0;
+	case Oinvert:
+		*size = n*n*sizeof(double);
+		return 0;
+	case Osort:
+		*size = n*sizeof(int32);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ *	the stripe is kept as long as jobs come in the same shape, so
+ *	a stream of them runs on memory that is already faulted in.
+ */
+static Stripe *
+stripeget(int nrows, int ncols)
+{
+	if(warm != NULL && warm->nrows == nrows && warm->ncols == ncols)
+		return warm;
+	if(warm != NULL)
+		stripefree(warm);
+	warm = stripealloc(nrows, ncols, layout, width);
+	return warm;
+}
+
+/*
+ *	gauss-jordan on [a | rhs] in column-cyclic stripes, as in
+ *	matrix.c but scaling the pivot row, so the right hand columns
+ *	end up as a^-1 rhs. lu stops at the diagonal and keeps the
+ *	multipliers in the pivot column instead.
+ */
+static int
+eliminate(Stripe *s, int n, int lu, int32 *ipiv)
+{
+	double h[n];
+	double *c, *r, *q;
+	size_t rs = s->stride;
+	int i, j, je, j0, k, w, col, row;
+	int pivrow;
+	double piv, maxval;
+
+	for(row = 0; row < n; row++){
+		if(row % cube_nranks == cube_id){
+			col = firstcol(row);
+			c = stripecol(s, col);
+			maxval = fabs(c[row*rs]);
+			pivrow = row;
+			for(i = row+1; i < n; i++){
+				if(fabs(c[i*rs]) > maxval){
+					maxval = fabs(c[i*rs]);
+					pivrow = i;
+				}
+			}
+			for(i = 0; i < n; i++)
+				h[i] = c[i*rs];
+		}
+		cubebroadcast(
+			row % cube_nranks,
+			(struct iovec[]){
+				{&pivrow, sizeof pivrow},
+				{h, sizeof h}
+			},
+			2
+		);
+		if(h[pivrow] == 0.0)
+			return Ssingular;
+		if(ipiv != NULL)
+			ipiv[row] = pivrow;
+
+		swap(h+pivrow, h+row, 1);
+		swaprows(s, pivrow, row);
+		piv = h[row];
+
+		if(lu){
+			for(i = row+1; i < n; i++)
+				h[i] /= piv;
+			if(row % cube_nranks == cube_id){
+				c = stripecol(s, firstcol(row));
+				for(i = row+1; i < n; i++)
+					c[i*rs] = h[i];
+			}
+			j0 = firstcol(row+1);
+		} else {
+			j0 = firstcol(row);
+		}
+
+		for(j = j0; j < s->ncols; j = je){
+			je = striperun(s, j);
+			w = je - j;
+			c = stripecol(s, j);
+			r = c + row*rs;
+			if(!lu)
+				for(k = 0; k < w; k++)
+					r[k] /= piv;
+			for(i = lu ? row+1 : 0; i < n; i++){
+				if(i == row)
+					continue;
+				q = c + i*rs;
+				for(k = 0; k < w; k++)
+					q[k] -= h[i]*r[k];
+			}
+		}
+	}
+	return Sok;
+}
+
+static int
+matrixjob(Job *job, double *a)
+{
+	Stripe *s;
+	double *c, *b;
+	int32 *ipiv;
+	int n, m, i, j, g, ncols, st;
+
+	n = job->n;
+	m = job->op == Osolve ? job->nrhs : job->op == Oinvert ? n : 0;
+	b = a + (size_t)n*n;
+	ipiv = job->op == Ofactor ? (int32 *)b : NULL;
+
+	ncols = firstcol(n+m);
+	s = stripeget(n, ncols);
+	if(s == NULL)
+		return Sbad;
+
+	for(j = 0; j < ncols; j++){
+		g = j*cube_nranks + cube_id;
+		c = stripecol(s, j);
+		for(i = 0; i < n; i++){
+			if(g < n)
+				c[(size_t)i*s->stride] = a[(size_t)i*n+g];
+			else if(job->op == Osolve)
+				c[(size_t)i*s->stride] = b[(size_t)i*m+g-n];
+			else
+				c[(size_t)i*s->stride] = i == g-n;
+		}
+	}
+
+	/* only rank 0 writes the pivots, the others keep them on the stack */
+	st = eliminate(s, n, job->op == Ofactor, cube_id == 0 ? ipiv : NULL);
+	if(st != Sok)
+		return st;
+
+	for(j = job->op == Ofactor ? 0 : firstcol(n); j < ncols; j++){
+		g = j*cube_nranks + cube_id;
+		c = stripecol(s, j);
+		for(i = 0; i < n; i++){
+			if(job->op == Ofactor)
+				a[(size_t)i*n+g] = c[(size_t)i*s->stride];
+			else if(job->op == Osolve)
+				b[(size_t)i*m+g-n] = c[(size_t)i*s->stride];
+			else
+				a[(size_t)i*n+g-n] = c[(size_t)i*s->stride];
+		}
+	}
+	return Sok;
+}
+
+/*
+ *	equal blocks across the cube, the last ones padded with the
+ *	largest key, which sorts to the end and is never written back.
+ *	an incomplete cube can't run the bitonic network, so there
+ *	rank 0 sorts it all.
+ */
+static int
+sortjob(Job *job, int32 *a)
+{
+	int64 n, blk, i, off;
+
+	n = job->n;
+	if(cube_nranks != 1<<cube_dim){
+		if(cube_id == 0 && sorti32(a, n) == -1)
+			return Sbad;
+		return Sok;
+	}
+	blk = (n + cube_nranks-1) / cube_nranks;
+	if(blk > nkeys){
+		free(keys);
+		keys = malloc(blk * sizeof keys[0]);
+		nkeys = blk;
+	}
+	off = blk * cube_id;
+	for(i = 0; i < blk; i++)
+		keys[i] = off+i < n ? a[off+i] : INT32_MAX;
+	cubesort(keys, blk);
+	for(i = 0; i < blk && off+i < n; i++)
+		a[off+i] = keys[i];
+	return Sok;
+}
+
+/*
+ *	every rank maps the file itself. the status is agreed on over
+ *	the cube before and after the work, so a rank that can't open
+ *	the file doesn't leave the others waiting in a broadcast.
+ */
+static int
+runjob(Job *job)
+{
+	struct stat st;
+	double v[1];
+	size_t size;
+	void *p;
+	int fd;
+
+	p = MAP_FAILED;
+	size = 0;
+	v[0] = Sbad;
+	fd = open(job->path, O_RDWR);
+	if(fd != -1 && job->n > 0 && opsize(job, &size) == 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= size)
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(fd != -1)
+		close(fd);
+	if(p != MAP_FAILED)
+		v[0] = Sok;
+	cubeallreduce(v, 1, Rmax);
+
+	if(v[0] == Sok){
+		if(job->op == Osort)
+			v[0] = sortjob(job, p);
+		else
+			v[0] = matrixjob(job, p);
+		cubeallreduce(v, 1, Rmax);
+	}
+	if(p != MAP_FAILED)
+		munmap(p, size);
+	return v[0];
+}
+
+static int
+announce(char *path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1){
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof sa.sun_path, "%s", path);
+	unlink(path);
+	if(bind(fd, (struct sockaddr *)&sa, sizeof sa) == -1){
+		fprintf(stderr, "bind '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(listen(fd, Nbatch) == -1){
+		fprintf(stderr, "listen '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ *	wait for one job, then take whatever else is already queued
+ *	up to a full batch.
+ */
+static int
+collect(int lfd, Batch *b, int *cfd, int64 *arrive)
+{
+	struct timeval tv = { Nwait/1000, (Nwait%1000)*1000 };
+	struct pollfd pfd;
+	Reply r;
+	int fd, tmo;
+
+	b->njob = 0;
+	tmo = -1;
+	while(b->njob < Nbatch){
+		pfd.fd = lfd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, tmo) <= 0)
+			break;
+		fd = accept(lfd, NULL, NULL);
+		if(fd == -1)
+			continue;
+		/* a client that connects and says nothing would hold up every rank */
+		if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) == -1
+				|| read(fd, &b->job[b->njob], sizeof b->job[0]) != sizeof b->job[0]){
+			close(fd);
+			continue;
+		}
+		b->job[b->njob].path[Npath-1] = '\0';
+		if(!jobok(&b->job[b->njob])){
+			memset(&r, 0, sizeof r);
+			r.status = Sbad;
+			if(write(fd, &r, sizeof r) != sizeof r)
+				fprintf(stderr, "cubed: bad job: reply: %s\n", strerror(errno));
+			close(fd);
+			continue;
+		}
+		cfd[b->njob] = fd;
+		arrive[b->njob] = nsec();
+		b->njob++;
+		tmo = 0;
+	}
+	return b->njob;
+}
+
+static void
+serve(int nranks, char *path)
+{
+	Batch b;
+	Reply r;
+	int64 arrive[Nbatch];
+	int64 start, end;
+	int cfd[Nbatch];
+	int lfd, k, quit;
+
+	lfd = -1;
+	initcuben(nranks);
+	if(cube_id == 0){
+		signal(SIGPIPE, SIG_IGN);
+		lfd = announce(path);
+		if(lfd == -1)
+			b.njob = -1;
+		else
+			printf("cubed: %d ranks on %s\n", cube_nranks, path);
+		fflush(stdout);
+	}
+	cubebroadcast(0, (struct iovec[]){{&b.njob, sizeof b.njob}}, 1);
+	if(b.njob == -1)
+		endcube();
+
+	for(quit = 0; !quit;){
+		if(cube_id == 0)
+			while(collect(lfd, &b, cfd, arrive) == 0)
+				;
+		cubebroadcast(0, (struct iovec[]){{&b, sizeof b}}, 1);
+		start = nsec();
+		for(k = 0; k < b.njob; k++){
+			if(b.job[k].op == Oquit){
+				r.status = Sok;
+				quit = 1;
+			} else {
+				r.status = runjob(&b.job[k]);
+			}
+			end = nsec();
+			if(cube_id != 0)
+				continue;
+			r.wait = start - arrive[k];
+			r.run = end - start;
+			start = end;
+			if(write(cfd[k], &r, sizeof r) != sizeof r)
+				fprintf(stderr, "cubed: job %d: reply: %s\n", k, strerror(errno));
+			close(cfd[k]);
+			printf("cubed: batch of %d, %s %d: %s, wait %.3f ms run %.3f ms\n",
+				b.njob, opname[b.job[k].op], b.job[k].n, statname[r.status], r.wait*1e-6, r.run*1e-6);
+			fflush(stdout);
+		}
+	}
+	if(cube_id == 0){
+		close(lfd);
+		unlink(path);
+	}
+	endcube();
+}
+
+static int
+client(char *path, int argc, char **argv)
+{
+	struct sockaddr_un sa;
+	char buf[PATH_MAX];
+	Job job;
+	Reply r;
+	int64 start, end;
+	int fd, op;
+
+	if(argc < 1)
+		return -1;
+	for(op = 0; op < nelem(opname); op++)
+		if(strcmp(argv[0], opname[op]) == 0)
+			break;
+	if(op == nelem(opname))
+		return -1;
+	memset(&job, 0, sizeof job);
+	job.op = op;
+	if(op != Oquit){
+		if(argc < 3)
+			return -1;
+		if(realpath(argv[1], buf) == NULL){
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+			exit(1);
+		}
+		if(strlen(buf) >= Npath){
+			fprintf(stderr, "%s: path longer than %d bytes\n", buf, Npath-1);
+			exit(1);
+		}
+		strcpy(job.path, buf);
+		job.n = strtol(argv[2], NULL, 10);
+		job.nrhs = argc > 3 ? strtol(argv[3], NULL, 10) : 1;
+	}
+
+	start = nsec();
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof sa.sun_path, "%s", path);
+	if(connect(fd, (struct sockaddr *)&sa, sizeof sa) == -1){
+		fprintf(stderr, "connect '%s': %s\n", path, strerror(errno));
+		exit(1);
+	}
+	if(write(fd, &job, sizeof job) != sizeof job || read(fd, &r, sizeof r) != sizeof r){
+		fprintf(stderr, "cubed: lost the server: %s\n", strerror(errno));
+		exit(1);
+	}
+	end = nsec();
+	printf("%s %d: %s, wait %.3f ms run %.3f ms, %.3f ms round trip\n",
+		opname[op], job.n, statname[r.status], r.wait*1e-6, r.run*1e-6, (end-start)*1e-6);
+	exit(r.status == Sok ? 0 : 1);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: cubed [-l row|col|panel] [-w panelwidth] [-p nranks] [-s socket]\n");
+	fprintf(stderr, "       cubed -c [-s socket] factor|solve|invert|sort file n [nrhs]\n");
+	fprintf(stderr, "       cubed -c [-s socket] quit\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *path;
+	int opt, nranks, cflag;
+
+	path = "cubed.sock";
+	nranks = sysconf(_SC_NPROCESSORS_ONLN);
+	cflag = 0;
+	while((opt = getopt(argc, argv, "cl:w:p:s:")) != -1){
+		switch(opt){
+		case 'c':
+			cflag = 1;
+			break;
+		case 'l':
+			layout = stripelayout(optarg);
+			if(layout == -1)
+				usage();
+			break;
+		case 'w':
+			width = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			nranks = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if(cflag){
+		client(path, argc, argv);
+		usage();
+	}
+	if(argc != 0 || nranks < 1 || nranks > 1<<20)
+		usage();
+	serve(nranks, path);
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+#include "sortlib.h"
+
+/*
+ *	merge two sorted blocks of n and keep the lower or upper n.
+ */
+static void
+mergesplit(int *arr, int *other, int *tmp, int64 n, int keeplow)
+{
+	int64 i, j, k;
+
+	if(keeplow){
+		i = j = 0;
+		for(k = 0; k < n; k++)
+			tmp[k] = (j >= n || (i < n && arr[i] <= other[j])) ? arr[i++] : other[j++];
+	} else {
+		i = j = n-1;
+		for(k = n-1; k >= 0; k--)
+			tmp[k] = (j < 0 || (i >= 0 && arr[i] >= other[j])) ? arr[i--] : other[j--];
+	}
+	memcpy(arr, tmp, n * sizeof arr[0]);
+}
+
+/*
+ *	bitonic sort across the cube, each rank holding a block of n.
+ *	blocks are first sorted locally, then every merge stage of the
+ *	network is a compare-split with the partner across one link.
+ */
+void
+cubesort(int32 *arr, int64 n)
+{
+	int *other, *tmp;
+	int k, d, up;
+
+	bitonsorti32(arr, n);
+	if(cube_dim == 0)
+		return;
+
+	other = malloc(n * sizeof other[0]);
+	tmp = malloc(n * sizeof tmp[0]);
+	for(k = 1; k <= cube_dim; k++){
+		up = k == cube_dim || (cube_id & (1<<k)) == 0;
+		for(d = k-1; d >= 0; d--){
+			cubeexchange(
+				d,
+				(struct iovec[]){{arr, n * sizeof arr[0]}}, 1,
+				(struct iovec[]){{other, n * sizeof other[0]}}, 1
+			);
+			mergesplit(arr, other, tmp, n, ((cube_id & (1<<d)) == 0) == up);
+		}
+	}
+	free(other);
+	free(tmp);
+}
@@ -0,0 +1,510 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "pool.h"
+#include "sortlib.h"
+
+#include <aio.h>
+
+enum {
+	Nmem = 256*1024*1024,	/* default memory budget */
+	Nminblk = 64*1024,	/* smallest merge read block */
+	Nalign = 4096,
+};
+
+typedef struct Run Run;
+typedef struct Aiobuf Aiobuf;
+
+/*
+ *	one outstanding asynchronous read or write
+ */
+struct Aiobuf {
+	struct aiocb cb;
+	int busy;
+};
+
+/*
+ *	a sorted run in the run file being merged. buf[cur] is being
+ *	consumed while the next block is read into buf[!cur].
+ */
+struct Run {
+	int64 off;
+	int64 end;
+	int32 *buf[2];
+	int64 len[2];
+	int64 pos;
+	int cur;
+	Aiobuf io;
+};
+
+static int64
+parsesize(char *s)
+{
+	char *r;
+	int64 n;
+
+	n = strtoll(s, &r, 10);
+	switch(*r){
+	case 'k': case 'K':
+		n *= 1024;
+		break;
+	case 'm': case 'M':
+		n *= 1024*1024;
+		break;
+	case 'g': case 'G':
+		n *= 1024*1024*1024;
+		break;
+	}
+	return n;
+}
+
+static void
+aiostart(Aiobuf *a, int fd, void *buf, int64 len, int64 off, int write)
+{
+	memset(&a->cb, 0, sizeof a->cb);
+	a->cb.aio_fildes = fd;
+	a->cb.aio_buf = buf;
+	a->cb.aio_nbytes = len;
+	a->cb.aio_offset = off;
+	if((write ? aio_write(&a->cb) : aio_read(&a->cb)) == -1){
+		fprintf(stderr, "extsort: aio_%s: %s\n", write ? "write" : "read", strerror(errno));
+		exit(1);
+	}
+	a->busy = 1;
+}
+
+static int64
+aiowait(Aiobuf *a)
+{
+	const struct aiocb *list[1];
+	ssize_t n;
+	int err;
+
+	if(!a->busy)
+		return 0;
+	list[0] = &a->cb;
+	while((err = aio_error(&a->cb)) == EINPROGRESS)
+		aio_suspend(list, 1, NULL);
+	a->busy = 0;
+	n = aio_return(&a->cb);
+	if(err != 0 || n == -1){
+		fprintf(stderr, "extsort: aio: %s\n", strerror(err));
+		exit(1);
+	}
+	if((size_t)n != a->cb.aio_nbytes){
+		fprintf(stderr, "extsort: short aio, %zd of %zu bytes\n", n, a->cb.aio_nbytes);
+		exit(1);
+	}
+	return n;
+}
+
+/*
+ *	hugealloc rounds up to a huge page and touches all of it, which
+ *	a merge of hundreds of runs with small blocks can't afford.
+ *	smaller buffers come from the heap, aligned for direct io.
+ */
+static void *
+bufalloc(int64 size)
+{
+	void *p;
+
+	if(size >= Hugepage)
+		p = hugealloc(size);
+	else if(posix_memalign(&p, Nalign, size) != 0)
+		p = NULL;
+	if(p == NULL){
+		fprintf(stderr, "extsort: cannot allocate %lld bytes\n", size);
+		exit(1);
+	}
+	return p;
+}
+
+static void
+buffree(void *p, int64 size)
+{
+	if(size >= Hugepage)
+		hugefree(p, size);
+	else
+		free(p);
+}
+
+/*
+ *	cut the input into chunks that fit in memory, sort each and
+ *	write it out as a run. three buffers rotate: one is being read,
+ *	one sorted and one written, so the disk never waits on the cpu.
+ */
+static int
+mkruns(int in, int out, int64 nkeys, int64 chunk, int64 *runoff)
+{
+	Aiobuf rd, wr;
+	int32 *buf[3], *tmp, *t;
+	int64 len[2], off, n;
+	int nruns, i;
+
+	for(i = 0; i < 3; i++)
+		buf[i] = bufalloc(chunk * sizeof buf[i][0]);
+	tmp = bufalloc(chunk * sizeof tmp[0]);
+	memset(&rd, 0, sizeof rd);
+	memset(&wr, 0, sizeof wr);
+
+	nruns = 0;
+	n = nkeys < chunk ? nkeys : chunk;
+	len[0] = n;
+	if(n > 0)
+		aiostart(&rd, in, buf[0], n * sizeof buf[0][0], 0, 0);
+	off = n;
+	while(rd.busy){
+		aiowait(&rd);
+
+		/* buf[0] is in, start on the next chunk */
+		n = nkeys-off < chunk ? nkeys-off : chunk;
+		len[1] = n;
+		if(n > 0)
+			aiostart(&rd, in, buf[1], n * sizeof buf[1][0], off * sizeof buf[1][0], 0);
+		off += n;
+
+		if(poolthreads() > 1)
+			parsorti32(buf[0], tmp, len[0]);
+		else
+			radixsorti32(buf[0], tmp, len[0]);
+
+		aiowait(&wr);
+		runoff[nruns+1] = runoff[nruns] + len[0];
+		aiostart(&wr, out, buf[0], len[0] * sizeof buf[0][0], runoff[nruns] * sizeof buf[0][0], 1);
+		nruns++;
+
+		/* written becomes free, read becomes current */
+		t = buf[2];
+		buf[2] = buf[0];
+		buf[0] = buf[1];
+		buf[1] = t;
+		len[0] = len[1];
+	}
+	aiowait(&wr);
+
+	for(i = 0; i < 3; i++)
+		buffree(buf[i], chunk * sizeof buf[i][0]);
+	buffree(tmp, chunk * sizeof tmp[0]);
+	return nruns;
+}
+
+static void
+runfill(Run *r, int fd, int64 blk)
+{
+	int64 n;
+
+	n = r->end - r->off < blk ? r->end - r->off : blk;
+	r->len[!r->cur] = n;
+	if(n > 0)
+		aiostart(&r->io, fd, r->buf[!r->cur], n * sizeof r->buf[0][0], r->off * sizeof r->buf[0][0], 0);
+	r->off += n;
+}
+
+/*
+ *	the key at the head of the run, or past the end of int32
+ *	once it is used up.
+ */
+static int64
+runkey(Run *r)
+{
+	if(r->pos == r->len[r->cur])
+		return INT64_MAX;
+	return r->buf[r->cur][r->pos];
+}
+
+static void
+runnext(Run *r, int fd, int64 blk)
+{
+	if(++r->pos < r->len[r->cur])
+		return;
+	if(!r->io.busy){
+		r->len[r->cur] = 0;
+		r->pos = 0;
+		return;
+	}
+	aiowait(&r->io);
+	r->cur = !r->cur;
+	r->pos = 0;
+	runfill(r, fd, blk);
+}
+
+/*
+ *	loser tree over k runs: node n > 0 holds the loser of the match
+ *	played there, tree[0] the overall winner. ties go to the lower
+ *	run so the merge is stable.
+ */
+static int
+beats(int64 *key, int a, int b)
+{
+	return key[a] < key[b] || (key[a] == key[b] && a < b);
+}
+
+static void
+ltbuild(int *tree, int64 *key, int k)
+{
+	int w[2*k];
+	int n, a, b;
+
+	for(n = 0; n < k; n++)
+		w[k+n] = n;
+	for(n = k-1; n >= 1; n--){
+		a = w[2*n];
+		b = w[2*n+1];
+		w[n] = beats(key, a, b) ? a : b;
+		tree[n] = beats(key, a, b) ? b : a;
+	}
+	tree[0] = w[1];
+}
+
+static void
+ltreplay(int *tree, int64 *key, int k, int i)
+{
+	int n, t;
+
+	for(n = (i+k)/2; n >= 1; n /= 2){
+		if(beats(key, tree[n], i)){
+			t = tree[n];
+			tree[n] = i;
+			i = t;
+		}
+	}
+	tree[0] = i;
+}
+
+/*
+ *	merge the runs into the output, reading every run one block
+ *	ahead and writing one block behind.
+ */
+static int64
+mergeruns(int in, int out, int nruns, int64 *runoff, int64 mem, int64 *nbad)
+{
+	Run *run;
+	Aiobuf wr;
+	int64 key[nruns], blk, obk, nout, off, last;
+	int32 *obuf[2];
+	int tree[nruns];
+	int i, w, cur;
+
+	/* two blocks per run, and what is left to the two output blocks */
+	blk = mem / (2 * (nruns+2)) / sizeof(int32);
+	blk &= ~(int64)(Nalign/sizeof(int32) - 1);
+	if(blk < Nminblk/(int64)sizeof(int32)){
+		blk = Nminblk/sizeof(int32);
+		fprintf(stderr, "extsort: %d runs of %lld kB blocks are over the budget\n",
+			nruns, blk * (int64)sizeof(int32) / 1024);
+	}
+	obk = (mem / (int64)sizeof(int32) - 2*nruns*blk) / 2;
+	obk &= ~(int64)(Nalign/sizeof(int32) - 1);
+	if(obk < blk)
+		obk = blk;
+
+	run = malloc(nruns * sizeof run[0]);
+	memset(run, 0, nruns * sizeof run[0]);
+	for(i = 0; i < nruns; i++){
+		run[i].buf[0] = bufalloc(blk * sizeof(int32));
+		run[i].buf[1] = bufalloc(blk * sizeof(int32));
+		run[i].off = runoff[i];
+		run[i].end = runoff[i+1];
+		run[i].cur = 1;
+		runfill(&run[i], in, blk);
+	}
+	for(i = 0; i < nruns; i++){
+		aiowait(&run[i].io);
+		run[i].cur = 0;
+		run[i].pos = 0;
+		runfill(&run[i], in, blk);
+		key[i] = runkey(&run[i]);
+	}
+	ltbuild(tree, key, nruns);
+
+	obuf[0] = bufalloc(obk * sizeof(int32));
+	obuf[1] = bufalloc(obk * sizeof(int32));
+	memset(&wr, 0, sizeof wr);
+	cur = 0;
+	nout = 0;
+	off = 0;
+	last = INT64_MIN;
+	*nbad = 0;
+	for(;;){
+		w = tree[0];
+		if(key[w] == INT64_MAX)
+			break;
+		if(key[w] < last)
+			(*nbad)++;
+		last = key[w];
+		obuf[cur][nout++] = key[w];
+		if(nout == obk){
+			aiowait(&wr);
+			aiostart(&wr, out, obuf[cur], nout * sizeof(int32), off * sizeof(int32), 1);
+			off += nout;
+			cur = !cur;
+			nout = 0;
+		}
+		runnext(&run[w], in, blk);
+		key[w] = runkey(&run[w]);
+		ltreplay(tree, key, nruns, w);
+	}
+	aiowait(&wr);
+	if(nout > 0){
+		aiostart(&wr, out, obuf[cur], nout * sizeof(int32), off * sizeof(int32), 1);
+		aiowait(&wr);
+		off += nout;
+	}
+
+	for(i = 0; i < nruns; i++){
+		buffree(run[i].buf[0], blk * sizeof(int32));
+		buffree(run[i].buf[1], blk * sizeof(int32));
+	}
+	buffree(obuf[0], obk * sizeof(int32));
+	buffree(obuf[1], obk * sizeof(int32));
+	free(run);
+	return off;
+}
+
+static void
+generate(char *path, int64 nkeys)
+{
+	int32 buf[64*1024];
+	int64 i, n;
+	int fd;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1){
+		fprintf(stderr, "extsort: create '%s': %s\n", path, strerror(errno));
+		exit(1);
+	}
+	srand48(nsec());
+	while(nkeys > 0){
+		n = nkeys < nelem(buf) ? nkeys : nelem(buf);
+		for(i = 0; i < n; i++)
+			buf[i] = mrand48();
+		if(write(fd, buf, n * sizeof buf[0]) != n * (int64)sizeof buf[0]){
+			fprintf(stderr, "extsort: write '%s': %s\n", path, strerror(errno));
+			exit(1);
+		}
+		nkeys -= n;
+	}
+	close(fd);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: extsort [-m mem] infile outfile\n");
+	fprintf(stderr, "       extsort -g nkeys outfile\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stat st;
+	char runpath[1024];
+	int64 mem, chunk, nkeys, nout, nbad;
+	double mb;
+	int64 *runoff;
+	int64 t0, t1, t2;
+	int64 ngen;
+	int in, out, runfd, nruns, opt;
+
+	mem = Nmem;
+	ngen = -1;
+	while((opt = getopt(argc, argv, "m:g:")) != -1){
+		switch(opt){
+		case 'm':
+			mem = parsesize(optarg);
+			break;
+		case 'g':
+			ngen = parsesize(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if(ngen >= 0){
+		if(argc != 1)
+			usage();
+		generate(argv[0], ngen);
+		return 0;
+	}
+	if(argc != 2)
+		usage();
+
+	in = open(argv[0], O_RDONLY);
+	if(in == -1 || fstat(in, &st) == -1){
+		fprintf(stderr, "extsort: open '%s': %s\n", argv[0], strerror(errno));
+		exit(1);
+	}
+	out = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+	if(out == -1){
+		fprintf(stderr, "extsort: create '%s': %s\n", argv[1], strerror(errno));
+		exit(1);
+	}
+	snprintf(runpath, sizeof runpath, "%s.runs", argv[1]);
+	runfd = open(runpath, O_RDWR|O_CREAT|O_TRUNC, 0666);
+	if(runfd == -1){
+		fprintf(stderr, "extsort: create '%s': %s\n", runpath, strerror(errno));
+		exit(1);
+	}
+	unlink(runpath);
+
+	nkeys = st.st_size / sizeof(int32);
+	/* three chunk buffers and the radix scratch share the budget */
+	chunk = mem / 4 / sizeof(int32);
+	chunk &= ~(int64)(Nalign/sizeof(int32) - 1);
+	if(chunk <= 0)
+		usage();
+	if(chunk > nkeys)
+		chunk = (nkeys + Nalign-1) & ~(int64)(Nalign-1);
+	if(chunk == 0)
+		chunk = Nalign;
+	runoff = malloc((nkeys/chunk + 2) * sizeof runoff[0]);
+	runoff[0] = 0;
+
+	poolinit(sysconf(_SC_NPROCESSORS_ONLN));
+	t0 = nsec();
+	nruns = mkruns(in, runfd, nkeys, chunk, runoff);
+	t1 = nsec();
+	poolend();
+	nout = 0;
+	nbad = 0;
+	if(nruns > 0)
+		nout = mergeruns(runfd, out, nruns, runoff, mem, &nbad);
+	t2 = nsec();
+
+	if(nout != nkeys || nbad != 0)
+		fprintf(stderr, "extsort: %lld of %lld keys out, %lld out of order\n", nout, nkeys, nbad);
+
+	mb = nkeys * sizeof(int32) / (1024.0*1024.0);
+	printf("extsort %.1f MB, %d runs of %lld kB\n", mb, nruns, chunk * (int64)sizeof(int32) / 1024);
+	printf("extsort runs %.4f s, %.1f MB/s\n", (t1-t0)*1e-9, mb / ((t1-t0)*1e-9));
+	printf("extsort merge %.4f s, %.1f MB/s\n", (t2-t1)*1e-9, mb / ((t2-t1)*1e-9));
+	printf("extsort total %.4f s, %.1f MB/s\n", (t2-t0)*1e-9, mb / ((t2-t0)*1e-9));
+
+	close(in);
+	close(out);
+	close(runfd);
+	return 0;
+}
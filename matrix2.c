@@ -21,13 +21,30 @@
  */
 #include "os.h"
 #include "cube.h"
+#include "stripe.h"
+#include "ckpt.h"
+#include "pool.h"
+#include "tune.h"
 
 enum {
 	Ndim = 0,
 	N = 1024,
+	Ncal = 64,	/* fewest rows a tuning run eliminates */
 };
 
-double *m;
+typedef struct Update Update;
+
+/* columns j0 .. j1-1 of the update for row, for one thread */
+struct Update {
+	Stripe *s;
+	double *rowhead;
+	double piv;
+	int row;
+	int j0;
+	int j1;
+};
+
+Stripe *m;
 
 static void
 swap(double *p, double *q, int n)
@@ -41,51 +58,150 @@ swap(double *p, double *q, int n)
 	}
 }
 
+static void
+swaprows(Stripe *s, int p, int q)
+{
+	double *c;
+	int j, je;
+	for(j = 0; j < s->ncols; j = je){
+		je = striperun(s, j);
+		c = stripecol(s, j);
+		swap(c + (size_t)p*s->stride, c + (size_t)q*s->stride, je-j);
+	}
+}
+
 void
-dumpmatrix(double *m, int ncols, int nrows)
+dumpmatrix(Stripe *s)
 {
 	int i, j;
-	for(i = 0; i < nrows; i++){
+	for(i = 0; i < s->nrows; i++){
 		printf("%2d:", i);
-		for(j = 0; j < ncols; j++){
-			printf(" %5.2f", m[i*ncols+j]);
+		for(j = 0; j < s->ncols; j++){
+			printf(" %5.2f", stripecol(s, j)[(size_t)i*s->stride]);
 		}
 		printf("\n");
 	}
 	printf("\n");
 }
 
+/*
+ *	one run of columns that are contiguous within a row at a time,
+ *	cut short where the next thread's columns start.
+ */
+static void
+update(void *arg)
+{
+	Update *u = arg;
+	Stripe *s = u->s;
+	size_t rs = s->stride;
+	double *rowhead = u->rowhead;
+	double piv = u->piv;
+	double *c, *r, *q;
+	int i, j, je, k, w, row = u->row;
+
+	for(j = u->j0; j < u->j1; j = je){
+		je = striperun(s, j);
+		if(je > u->j1)
+			je = u->j1;
+		w = je - j;
+		c = stripecol(s, j);
+		r = c + row*rs;
+		for(k = 0; k < w; k++)
+			r[k] = r[k] * piv;
+		if(w == 1){
+			for(i = row+1; i < s->nrows; i++)
+				c[i*rs] = c[i*rs] - rowhead[i]*r[0];
+			continue;
+		}
+		for(i = row+1; i < s->nrows; i++){
+			q = c + i*rs;
+			for(k = 0; k < w; k++)
+				q[k] = q[k] - rowhead[i]*r[k];
+		}
+	}
+}
+
+/*
+ *	columns col .. ncols-1 split over the threads of the pool, in
+ *	whole panels and at least 8 columns at a time. a row stripe's
+ *	rows are only cut between cache lines if ncols is a multiple
+ *	of 8 too.
+ */
+static void
+parupdate(Stripe *s, Update *u, double *rowhead, double piv, int row, int col)
+{
+	Join jn;
+	int t, nt, b, g;
+
+	nt = poolthreads();
+	if(nt < 1)
+		nt = 1;
+	g = s->layout == Lrow || s->width < 8 ? 8 : s->width;
+	for(t = 0; t < nt; t++){
+		u[t].s = s;
+		u[t].rowhead = rowhead;
+		u[t].piv = piv;
+		u[t].row = row;
+		u[t].j0 = t == 0 ? col : u[t-1].j1;
+		b = col + (int64)(s->ncols - col)*(t+1)/nt;
+		b += (g - b%g) % g;
+		u[t].j1 = t == nt-1 || b > s->ncols ? s->ncols : b;
+	}
+	if(nt == 1){
+		update(&u[0]);
+		return;
+	}
+	memset(&jn, 0, sizeof jn);
+	for(t = 0; t < nt; t++)
+		if(u[t].j0 < u[t].j1)
+			poolspawn(&jn, update, &u[t]);
+	poolwait(&jn);
+}
+
 /*
  *	this gauss-jordan elimination works on the principle that
  *	the matrix has been striped across processors by columns.
  *	full striping to utilize all processors
- *	elimination proceeds row by row.
+ *	elimination proceeds row by row, rows start .. end-1 here.
  */
 void
-gaussjordan(double *m, int ncols, int nrows)
+gaussjordan(Stripe *s, int start, int end, int *ipiv, Ckpt *ck)
 {
+	int nrows = s->nrows;
+	size_t rs = s->stride;
 	double rowhead[nrows];
 	double piv, maxval;
-	int i, j, col, row;
+	Update u[poolthreads() > 0 ? poolthreads() : 1];
+	double *c;
+	int i, col, row;
 	int pivrow;
+	int ppivot, pbcast, pupdate;
 
 	memset(rowhead, 0, sizeof rowhead);
-	for(row = 0; row < nrows; row++){
+	ppivot = profregion("pivot");
+	pbcast = profregion("broadcast");
+	pupdate = profregion("update");
+	for(row = start; row < end; row++){
+		/* the state before row goes out, rows 0 .. row-1 are done */
+		if(ck->every > 0 && row > start && row % ck->every == 0)
+			ckptsave(ck, s, ipiv, row);
 
-		col = row >> cube_dim;
-		if((row & cube_mask) != 0 && (row & cube_mask) > cube_id)
+		col = row / cube_nranks;
+		if(row % cube_nranks > cube_id)
 			col++;
 
-		if((row & cube_mask) == cube_id){
+		profbegin(ppivot);
+		if(row % cube_nranks == cube_id){
 			/* we own this diagonal element */
 			/* .. so find the next pivot */
-			piv = m[row*ncols+col];
+			c = stripecol(s, col);
+			piv = c[row*rs];
 			maxval = fabs(piv);
 			pivrow = row;
 			if(1 || maxval < 1e-3){
 				for(i = row+1; i < nrows; i++){
-					if(fabs(m[i*ncols+col]) > maxval){
-						piv = m[i*ncols+col];
+					if(fabs(c[i*rs]) > maxval){
+						piv = c[i*rs];
 						maxval = fabs(piv);
 						pivrow = i;
 					}
@@ -96,85 +212,275 @@ gaussjordan(double *m, int ncols, int nrows)
 			if(maxval < 1e-9)
 				fprintf(stderr, "%d: row %d col %d tiny maxval %.20f\n", cube_id, row, col, maxval);
 			for(i = 0; i < nrows; i++)
-				rowhead[i] = m[i*ncols+col];
+				rowhead[i] = c[i*rs];
 			rowhead[pivrow] = piv;
 		}
+		profend(ppivot);
+
+		profbegin(pbcast);
 		cubebroadcast(
-			row & cube_mask,
+			row % cube_nranks,
 			(struct iovec[]){	
 				{&pivrow, sizeof pivrow},
 				{rowhead, sizeof rowhead}
 			},
 			2
 		);
+		profend(pbcast);
+		ipiv[row] = pivrow;
 
+		profbegin(pupdate);
 		piv = 1.0 / rowhead[pivrow];
 		swap(rowhead+pivrow, rowhead+row, 1);
-		swap(m+pivrow*ncols, m+row*ncols, ncols);
-		for(j = col; j < ncols; j++)
-			m[row*ncols+j] = m[row*ncols+j] * piv;
-		for(i = row+1; i < nrows; i++)
-			for(j = col; j < ncols; j++)
-				m[i*ncols+j] = m[i*ncols+j] - rowhead[i]*m[row*ncols+j];
+		swaprows(s, pivrow, row);
+		parupdate(s, u, rowhead, piv, row, col);
+		profend(pupdate);
 	}
+	ckptdone(ck);
+}
+
+/* the stripe of this rank, after initcube so that it is local */
+static Stripe *
+localstripe(int nrows, int layout, int width)
+{
+	int ncols;
+
+	ncols = nrows / cube_nranks;
+	if(nrows % cube_nranks > cube_id)
+		ncols++;
+	if(ncols <= 0){
+		fprintf(stderr, "matrix %d is too small for %d ranks\n", nrows, cube_nranks);
+		exit(1);
+	}
+	return stripealloc(nrows, ncols, layout, width);
+}
+
+static void
+randomfill(Stripe *s)
+{
+	double *c, *p;
+	int i, j, je, k;
+
+	for(j = 0; j < s->ncols; j = je){
+		je = striperun(s, j);
+		c = stripecol(s, j);
+		for(i = 0; i < s->nrows; i++){
+			for(k = 0; k < je-j; k++){
+				p = c + (size_t)i*s->stride + k;
+				do {
+					*p = 1.0 - 2.0*drand48();
+				} while(fabs(*p) < 1e-6);
+			}
+		}
+	}
+}
+
+/*
+ *	a calibration run for the tuner, in a child of its own: the
+ *	first eighth of the rows, which is plenty to tell the ways of
+ *	running it apart.
+ */
+static double
+trial(Tune *t, int nrows)
+{
+	double secs[1];
+	int64 start;
+	int *ipiv;
+	int end;
+	Ckpt ck;
+
+	tuneapply(t);
+	m = localstripe(nrows, t->layout, t->width);
+	if(m == NULL)
+		exit(1);
+	ipiv = malloc(nrows * sizeof ipiv[0]);
+	ckptinit(&ck, "matrix2.ckpt", 0);
+	srand48(getpid());
+	randomfill(m);
+
+	end = nrows/8 > Ncal ? nrows/8 : Ncal;
+	if(end > nrows)
+		end = nrows;
+	secs[0] = 0.0;
+	cubeallreduce(secs, 1, Rsum);
+	start = nsec();
+	gaussjordan(m, 0, end, ipiv, &ck);
+	secs[0] = (nsec() - start) * 1e-9;
+	cubeallreduce(secs, 1, Rmax);
+	return secs[0];
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: matrix2 [-l row|col|panel] [-w panelwidth] [-p nranks] [-t threads] [-f fragsize] [-c every] [-r] [-T ncpu] [-n nrows] [dim [nrows]]\n");
+	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-	int i, j;
+	double *c;
+	int i, j, je, k;
 	int nz, nnz;
 	int dim = Ndim;
-	int ncols, nrows;
+	int nrows;
+	int layout, width, nthreads, frag;
+	int opt, nranks, ncpu, tuned;
+	int every, restart, start;
+	int *ipiv;
+	Ckpt ck;
+	Tune t;
 
+	layout = -1;
+	width = 0;
+	nranks = 0;
+	nthreads = 0;
+	frag = -1;
+	ncpu = -1;
+	every = 0;
+	restart = 0;
 	nrows = N;
+	while((opt = getopt(argc, argv, "l:w:p:t:f:c:rT:n:")) != -1){
+		switch(opt){
+		case 'l':
+			layout = stripelayout(optarg);
+			if(layout == -1)
+				usage();
+			break;
+		case 'w':
+			width = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			nranks = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			nthreads = strtol(optarg, NULL, 10);
+			break;
+		case 'f':
+			frag = strtol(optarg, NULL, 10);
+			break;
+		case 'c':
+			every = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			restart = 1;
+			break;
+		case 'T':
+			ncpu = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			nrows = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if(argc > 0){
+		dim = strtol(argv[0], NULL, 10);
+		if(dim < 0 || dim > 20){
+			printf("crazy dim %d (want 0 <= dim <= 20)\n", dim);
+			exit(1);
+		}
+		/* -p overrides dim, for rank counts that aren't a power of two */
+		if(nranks == 0)
+			nranks = 1 << dim;
+	}
 	if(argc > 1)
-		dim = strtol(argv[1], NULL, 10);
-	if(argc > 2)
-		nrows = strtol(argv[2], NULL, 10);
+		nrows = strtol(argv[1], NULL, 10);
+	if(nrows < 1){
+		printf("crazy matrix size %d\n", nrows);
+		exit(1);
+	}
 
-	if(dim < 0 || dim > 20){
-		printf("crazy dim %d (want 0 <= dim <= 20)\n", dim);
+	/*
+	 *	the profile for this size fills in what the options leave
+	 *	out, except on a restart: the checkpoints are only good for
+	 *	the configuration they were written with, given again.
+	 */
+	tunedefault(&t);
+	tuned = -1;
+	if(ncpu == -1 && !restart)
+		tuned = tuneload("matrix2", nrows, &t);
+	if(nranks != 0)
+		t.nranks = nranks;
+	if(nthreads != 0)
+		t.nthreads = nthreads;
+	if(layout != -1)
+		t.layout = layout;
+	if(width != 0)
+		t.width = width;
+	if(frag != -1)
+		t.frag = frag;
+	if(t.nranks < 1 || t.nranks > 1<<20){
+		printf("crazy rank count %d (want 1 <= nranks <= %d)\n", t.nranks, 1<<20);
+		exit(1);
+	}
+	if(t.nthreads < 1){
+		printf("crazy thread count %d\n", t.nthreads);
 		exit(1);
 	}
 
+	/* -T sweeps from there over ncpu cpus, all of them for 0 */
+	if(ncpu != -1){
+		if(ncpu < 1)
+			ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		tunesweep("matrix2", nrows, ncpu, &t, trial);
+		printf("matrix2 %d: best -p %d -t %d -l %s -w %d -f %d  %.6f s, into %s\n", nrows,
+			t.nranks, t.nthreads, stripename(t.layout), t.width, t.frag, t.secs, tunefile());
+		return tunesave("matrix2", nrows, &t) == -1;
+	}
+	if(tuned != -1)
+		printf("matrix2 %d: -p %d -t %d -l %s -w %d -f %d, as tuned for %d in %s\n", nrows,
+			t.nranks, t.nthreads, stripename(t.layout), t.width, t.frag, tuned, tunefile());
+
 	long seed;
 	seed = getpid();
-	initcube(dim);
-	seed = (seed << dim) | cube_id;
+	tuneapply(&t);
+	proftag(cube_id);
+	seed = (seed << cube_dim) | cube_id;
 
-	ncols = nrows >> cube_dim;
-	if((nrows & cube_mask) != 0 && (nrows & cube_mask) > cube_id)
-		ncols++;
-	if(ncols <= 0){
-		fprintf(stderr, "matrix %d is too small for cube dim %d\n", nrows, cube_dim);
+	m = localstripe(nrows, t.layout, t.width);
+	if(m == NULL)
 		exit(1);
-	}
 
-	m = malloc(ncols * nrows * sizeof m[0]);
+	ipiv = malloc(nrows * sizeof ipiv[0]);
+	ckptinit(&ck, "matrix2.ckpt", every);
+	start = 0;
+	if(restart)
+		start = ckptload(&ck, m, ipiv);
+	if(start == -1)
+		exit(1);
 
 	srand48(seed | cube_id);
-	for(i = 0; i < nrows*ncols; i++){
-		do {
-			m[i] = 1.0 - 2.0*drand48();
-		} while(fabs(m[i]) < 1e-6);
-	}
+	if(start == 0)
+		randomfill(m);
 
-	gaussjordan(m, ncols, nrows);
+	gaussjordan(m, start, nrows, ipiv, &ck);
 
 	nz = 0;
 	nnz = 0;
-	for(i = 0; i < nrows; i++){
-		for(j = 0; j < ncols; j++){
-			if(fabs(m[i*ncols+j]) < 1e-10){
-				nz++;
-			} else {
-				nnz++;
+	for(j = 0; j < m->ncols; j = je){
+		je = striperun(m, j);
+		c = stripecol(m, j);
+		for(i = 0; i < nrows; i++){
+			for(k = 0; k < je-j; k++){
+				if(fabs(c[(size_t)i*m->stride+k]) < 1e-10){
+					nz++;
+				} else {
+					nnz++;
+				}
 			}
 		}
 	}
 
-	printf("%3d: %dx%d matrix, nnz %d nz %d\n", cube_id, ncols, nrows, nnz, nz);
+	printf("%3d: %dx%d matrix, nnz %d nz %d\n", cube_id, m->ncols, nrows, nnz, nz);
+
+	if(every > 0 || restart)
+		printf("%3d: resumed at row %d, %d checkpoints, %.4f s overhead\n", cube_id, start, ck.n, ck.ns*1e-9);
 
 	endcube();
 
@@ -21,10 +21,258 @@
  */
 #include "os.h"
 
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+enum {
+	Nprof = 32,
+	Nctr = 5,
+};
+
+typedef struct Prof Prof;
+typedef struct Ctr Ctr;
+
+struct Prof {
+	char *name;
+	int64 calls;
+	int64 ns;
+	uint64 ctr[Nctr];
+	int64 t0;
+	uint64 c0[Nctr];
+};
+
+struct Ctr {
+	char *name;
+	uint32 type;
+	uint64 config;
+};
+
+#define CACHE(c, op, res) ((c) | (op)<<8 | (res)<<16)
+
+static Ctr ctrtab[Nctr] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "llc-miss", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	{ "dtlb-miss", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	{ "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static Prof prof[Nprof];
+static int nprof;
+static int prof_fd[Nctr];
+static int prof_slot[Nctr];
+static int prof_nslot;
+static int prof_leader = -1;
+static int prof_pid;
+static int prof_off;
+static int prof_id;
+static char *prof_err;
+
 int64
 nsec(void)
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return ((int64)tv.tv_sec * 1000000000) + (int64)tv.tv_usec*1000;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64)ts.tv_sec * 1000000000) + (int64)ts.tv_nsec;
+}
+
+/*
+ *	2MB aligned anonymous memory, marked for transparent huge pages
+ *	and first-touched here, so the pages land on the numa node of
+ *	whoever calls this. cube ranks are pinned by initcube, so
+ *	allocate after it.
+ */
+void *
+hugealloc(size_t size)
+{
+	char *p, *q;
+	size_t len, head, tail;
+
+	size = (size + Hugepage-1) & ~(size_t)(Hugepage-1);
+	len = size + Hugepage;
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		fprintf(stderr, "hugealloc %zu: %s\n", size, strerror(errno));
+		return NULL;
+	}
+	q = (char *)(((uintptr_t)p + Hugepage-1) & ~(uintptr_t)(Hugepage-1));
+	head = q - p;
+	tail = len - head - size;
+	if(head > 0)
+		munmap(p, head);
+	if(tail > 0)
+		munmap(q + size, tail);
+#ifdef MADV_HUGEPAGE
+	madvise(q, size, MADV_HUGEPAGE);
+#endif
+	memset(q, 0, size);
+	return q;
+}
+
+void
+hugefree(void *p, size_t size)
+{
+	size = (size + Hugepage-1) & ~(size_t)(Hugepage-1);
+	munmap(p, size);
+}
+
+/*
+ *	named regions counting time and, where perf_event_open lets
+ *	us, cycles, instructions, llc, dtlb and branch misses of the
+ *	calling thread. counters that can't be opened are left out,
+ *	with none at all the regions still keep time. PROF=0 in the
+ *	environment turns it all off. each process prints its own
+ *	summary to stderr when it exits.
+ */
+static void
+profopen(void)
+{
+	struct perf_event_attr pe;
+	int i, fd;
+
+	prof_leader = -1;
+	prof_nslot = 0;
+	for(i = 0; i < Nctr; i++){
+		memset(&pe, 0, sizeof pe);
+		pe.size = sizeof pe;
+		pe.type = ctrtab[i].type;
+		pe.config = ctrtab[i].config;
+		pe.exclude_kernel = 1;
+		pe.exclude_hv = 1;
+		pe.read_format = PERF_FORMAT_GROUP;
+		fd = syscall(SYS_perf_event_open, &pe, 0, -1, prof_leader, 0);
+		prof_fd[i] = fd;
+		prof_slot[i] = -1;
+		if(fd == -1){
+			if(prof_err == NULL)
+				prof_err = strerror(errno);
+			continue;
+		}
+		if(prof_leader == -1)
+			prof_leader = fd;
+		prof_slot[i] = prof_nslot++;
+	}
+}
+
+static void
+profread(uint64 *v)
+{
+	uint64 buf[1+Nctr];
+	int i;
+
+	memset(v, 0, Nctr * sizeof v[0]);
+	if(prof_leader == -1)
+		return;
+	if(read(prof_leader, buf, sizeof buf) < (ssize_t)sizeof buf[0])
+		return;
+	for(i = 0; i < Nctr; i++)
+		if(prof_slot[i] != -1 && prof_slot[i] < (int)buf[0])
+			v[i] = buf[1+prof_slot[i]];
+}
+
+static void
+profexit(void)
+{
+	Prof *p;
+	int i;
+
+	if(prof_off || getpid() != prof_pid)
+		return;
+	if(prof_leader == -1)
+		fprintf(stderr, "%3d: prof: no counters (%s), times only\n", prof_id, prof_err ? prof_err : "none");
+	for(p = prof; p < prof+nprof; p++){
+		if(p->calls == 0)
+			continue;
+		fprintf(stderr, "%3d: prof %-10s calls %-8lld %10.6f s", prof_id, p->name, p->calls, p->ns*1e-9);
+		if(prof_leader != -1){
+			if(p->ctr[0] != 0)
+				fprintf(stderr, "  ipc %.2f", (double)p->ctr[1] / p->ctr[0]);
+			for(i = 0; i < Nctr; i++)
+				if(prof_slot[i] != -1)
+					fprintf(stderr, "  %s %llu", ctrtab[i].name, p->ctr[i]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+/*
+ *	counters belong to the process that opened them, so a forked
+ *	child (a cube rank) starts over with its own.
+ */
+static void
+profcheck(void)
+{
+	char *s;
+	int i;
+
+	if(prof_pid == getpid())
+		return;
+	if(prof_pid == 0){
+		s = getenv("PROF");
+		prof_off = s != NULL && strcmp(s, "0") == 0;
+		atexit(profexit);
+	} else {
+		for(i = 0; i < Nctr; i++)
+			if(prof_fd[i] != -1)
+				close(prof_fd[i]);
+	}
+	prof_pid = getpid();
+	for(i = 0; i < nprof; i++){
+		prof[i].calls = 0;
+		prof[i].ns = 0;
+		memset(prof[i].ctr, 0, sizeof prof[i].ctr);
+	}
+	if(!prof_off)
+		profopen();
+}
+
+int
+profregion(char *name)
+{
+	int i;
+
+	profcheck();
+	for(i = 0; i < nprof; i++)
+		if(strcmp(prof[i].name, name) == 0)
+			return i;
+	if(nprof == Nprof)
+		return -1;
+	prof[nprof].name = strdup(name);
+	return nprof++;
+}
+
+void
+proftag(int id)
+{
+	prof_id = id;
+}
+
+void
+profbegin(int r)
+{
+	Prof *p;
+
+	if(prof_off || r < 0)
+		return;
+	profcheck();
+	p = &prof[r];
+	profread(p->c0);
+	p->t0 = nsec();
+}
+
+void
+profend(int r)
+{
+	uint64 c[Nctr];
+	Prof *p;
+	int i;
+
+	if(prof_off || r < 0)
+		return;
+	p = &prof[r];
+	p->ns += nsec() - p->t0;
+	profread(c);
+	for(i = 0; i < Nctr; i++)
+		p->ctr[i] += c[i] - p->c0[i];
+	p->calls++;
 }
@@ -21,6 +21,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -32,6 +33,8 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include <sched.h>	// linux: sched_setaffinity, cpu_set_t etc.
 
@@ -45,4 +48,14 @@ typedef int int32;
 typedef unsigned long long uint64;
 typedef unsigned int uint32;
 
+enum {
+	Hugepage = 2*1024*1024,
+};
+
 int64 nsec(void);
+int profregion(char *name);
+void profbegin(int r);
+void profend(int r);
+void proftag(int id);
+void *hugealloc(size_t size);
+void hugefree(void *p, size_t size);
@@ -0,0 +1,238 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "pool.h"
+
+#include <pthread.h>
+
+typedef struct Task Task;
+typedef struct Deque Deque;
+
+struct Task {
+	void (*fn)(void *);
+	void *arg;
+	Join *join;
+};
+
+/*
+ *	the owner pushes and pops at the tail, thieves take from the
+ *	head, so the oldest and biggest pieces of work get stolen.
+ */
+struct Deque {
+	pthread_mutex_t lk;
+	Task *t;
+	int64 head;
+	int64 tail;
+	int64 cap;
+} __attribute__((aligned(64)));
+
+enum {
+	Ncap = 256,
+	Nspin = 64,
+};
+
+static Deque *pool_deque;
+static pthread_t *pool_thread;
+static int pool_n;
+static int pool_ncpu;
+static int pool_cpu[CPU_SETSIZE];
+static cpu_set_t pool_caller;
+static volatile int pool_stop;
+static __thread int pool_me;
+
+static void
+pin(int id)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(pool_cpu[id % pool_ncpu], &set);
+	pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+static void
+push(Deque *d, Task *t)
+{
+	Task *nt;
+	int64 i;
+
+	pthread_mutex_lock(&d->lk);
+	if(d->tail - d->head == d->cap){
+		nt = malloc(2 * d->cap * sizeof nt[0]);
+		for(i = d->head; i < d->tail; i++)
+			nt[i & (2*d->cap-1)] = d->t[i & (d->cap-1)];
+		free(d->t);
+		d->t = nt;
+		d->cap *= 2;
+	}
+	d->t[d->tail & (d->cap-1)] = *t;
+	d->tail++;
+	pthread_mutex_unlock(&d->lk);
+}
+
+static int
+pop(Deque *d, Task *t, int steal)
+{
+	int got;
+
+	got = 0;
+	pthread_mutex_lock(&d->lk);
+	if(d->tail > d->head){
+		if(steal)
+			*t = d->t[d->head++ & (d->cap-1)];
+		else
+			*t = d->t[--d->tail & (d->cap-1)];
+		got = 1;
+	}
+	pthread_mutex_unlock(&d->lk);
+	return got;
+}
+
+/*
+ *	run one task, our own newest or else the oldest of somebody
+ *	else's.
+ */
+static int
+runone(void)
+{
+	Task t;
+	int i, got;
+
+	got = pop(&pool_deque[pool_me], &t, 0);
+	for(i = 1; !got && i < pool_n; i++)
+		got = pop(&pool_deque[(pool_me + i) % pool_n], &t, 1);
+	if(!got)
+		return 0;
+	t.fn(t.arg);
+	__atomic_fetch_sub(&t.join->pending, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void *
+worker(void *arg)
+{
+	int idle;
+
+	pool_me = (int)(intptr_t)arg;
+	pin(pool_me);
+	idle = 0;
+	while(!pool_stop){
+		if(runone()){
+			idle = 0;
+		} else if(++idle < Nspin){
+			sched_yield();
+		} else {
+			usleep(50);
+		}
+	}
+	return NULL;
+}
+
+/*
+ *	the calling thread is worker 0 and does its share of the work
+ *	whenever it waits on a join. the workers go round the cpus the
+ *	caller may run on, so a cube rank keeps its threads to itself.
+ *	poolend lets the caller run on all of them again.
+ */
+int
+poolinit(int nthreads)
+{
+	int i;
+
+	if(nthreads < 1)
+		nthreads = 1;
+	pool_ncpu = 0;
+	if(pthread_getaffinity_np(pthread_self(), sizeof pool_caller, &pool_caller) == 0)
+		for(i = 0; i < CPU_SETSIZE; i++)
+			if(CPU_ISSET(i, &pool_caller))
+				pool_cpu[pool_ncpu++] = i;
+	if(pool_ncpu < 1){
+		pool_ncpu = 1;
+		pool_cpu[0] = 0;
+	}
+	pool_n = nthreads;
+	pool_stop = 0;
+	pool_deque = malloc(pool_n * sizeof pool_deque[0]);
+	pool_thread = malloc(pool_n * sizeof pool_thread[0]);
+	for(i = 0; i < pool_n; i++){
+		memset(&pool_deque[i], 0, sizeof pool_deque[i]);
+		pthread_mutex_init(&pool_deque[i].lk, NULL);
+		pool_deque[i].cap = Ncap;
+		pool_deque[i].t = malloc(Ncap * sizeof pool_deque[i].t[0]);
+	}
+	pool_me = 0;
+	pin(0);
+	for(i = 1; i < pool_n; i++){
+		if(pthread_create(&pool_thread[i], NULL, worker, (void *)(intptr_t)i) != 0){
+			fprintf(stderr, "poolinit: thread %d: %s\n", i, strerror(errno));
+			pool_n = i;
+			break;
+		}
+	}
+	return pool_n;
+}
+
+void
+poolend(void)
+{
+	int i;
+
+	pool_stop = 1;
+	for(i = 1; i < pool_n; i++)
+		pthread_join(pool_thread[i], NULL);
+	if(CPU_COUNT(&pool_caller) > 0)
+		pthread_setaffinity_np(pthread_self(), sizeof pool_caller, &pool_caller);
+	for(i = 0; i < pool_n; i++){
+		pthread_mutex_destroy(&pool_deque[i].lk);
+		free(pool_deque[i].t);
+	}
+	free(pool_deque);
+	free(pool_thread);
+	pool_deque = NULL;
+	pool_thread = NULL;
+	pool_n = 0;
+}
+
+int
+poolthreads(void)
+{
+	return pool_n;
+}
+
+void
+poolspawn(Join *j, void (*fn)(void *), void *arg)
+{
+	Task t;
+
+	__atomic_fetch_add(&j->pending, 1, __ATOMIC_RELAXED);
+	t.fn = fn;
+	t.arg = arg;
+	t.join = j;
+	push(&pool_deque[pool_me], &t);
+}
+
+void
+poolwait(Join *j)
+{
+	while(__atomic_load_n(&j->pending, __ATOMIC_ACQUIRE) > 0)
+		if(!runone())
+			sched_yield();
+}
@@ -0,0 +1,328 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+#include "simdsort.h"
+#include "sortlib.h"
+#include "select.h"
+
+enum {
+	Nsmall = 16,		/* insertion sort from here down */
+	Nsample = 600,		/* floyd-rivest samples above this */
+	Npart = 16*1024,	/* simd partition above this */
+	Nroom = 64*1024,	/* topk keys filtered between selects */
+};
+
+static void
+swap(int32 *a, int64 i, int64 j)
+{
+	int32 t;
+	t = a[i];
+	a[i] = a[j];
+	a[j] = t;
+}
+
+static void
+isort(int32 *a, int64 n)
+{
+	int64 i, j;
+	int32 x;
+
+	for(i = 1; i < n; i++){
+		x = a[i];
+		for(j = i; j > 0 && a[j-1] > x; j--)
+			a[j] = a[j-1];
+		a[j] = x;
+	}
+}
+
+int64
+partitioni32(int32 *a, int32 *tmp, int64 n, int32 t, int64 *neq)
+{
+	int64 lo;
+
+	lo = simdsort()->part(tmp, a, n, t, neq);
+	memcpy(a, tmp, n * sizeof a[0]);
+	return lo;
+}
+
+/*
+ *	floyd and rivest's select: on a large range, first select k
+ *	within a sample window around where it should land, so a[k] is
+ *	a pivot that leaves only a sliver of the range for the next
+ *	round. the window is first filled with a strided sample of the
+ *	range, or sorted and organ pipe inputs would pick bad pivots.
+ *	large ranges are split by the simd kernel through tmp, the rest
+ *	by the hoare loop of the paper. depth bounds the rounds as in
+ *	introselect; past it the range is just sorted, which with radix
+ *	sort is linear too.
+ */
+static void
+frselect(int32 *a, int32 *tmp, int64 left, int64 right, int64 k, int depth)
+{
+	int64 i, j, n, lo, neq, nl, nr, step;
+	double z, s, sd;
+	int32 t;
+
+	while(right - left >= Nsmall){
+		n = right - left + 1;
+		if(depth-- == 0){
+			if(sorti32(a+left, n) == -1)
+				isort(a+left, n);
+			return;
+		}
+		if(n > Nsample){
+			i = k - left + 1;
+			z = log(n);
+			s = 0.5 * exp(2*z/3);
+			sd = 0.5 * sqrt(z*s*(n-s)/n) * (i < n/2 ? -1 : 1);
+			nl = k - i*s/n + sd;
+			nr = k + (n-i)*s/n + sd;
+			if(nl < left)
+				nl = left;
+			if(nr > right)
+				nr = right;
+			/* spread the window over the range, so runs can't fool it */
+			step = n / (nr-nl+1);
+			for(i = nl; i <= nr; i++)
+				swap(a, i, left + (i-nl)*step);
+			frselect(a, tmp, nl, nr, k, depth);
+		}
+		t = a[k];
+		if(tmp != NULL && n > Npart){
+			lo = partitioni32(a+left, tmp, n, t, &neq);
+			if(k < left+lo)
+				right = left+lo-1;
+			else if(k < left+lo+neq)
+				return;
+			else
+				left = left+lo+neq;
+			continue;
+		}
+		i = left;
+		j = right;
+		swap(a, left, k);
+		if(a[right] > t)
+			swap(a, right, left);
+		while(i < j){
+			swap(a, i, j);
+			i++;
+			j--;
+			while(a[i] < t)
+				i++;
+			while(a[j] > t)
+				j--;
+		}
+		if(a[left] == t){
+			swap(a, left, j);
+		} else {
+			j++;
+			swap(a, j, right);
+		}
+		if(j <= k)
+			left = j+1;
+		if(k <= j)
+			right = j-1;
+	}
+	if(right > left)
+		isort(a+left, right-left+1);
+}
+
+void
+nthi32(int32 *a, int64 n, int64 k)
+{
+	int32 *tmp;
+	int depth;
+
+	if(k < 0 || k >= n)
+		return;
+	/* without room for tmp the hoare loop does all of it */
+	tmp = NULL;
+	if(n > Npart)
+		tmp = malloc(n * sizeof tmp[0]);
+	for(depth = 8; (1LL<<(depth-8)) < n; depth += 2)
+		;
+	frselect(a, tmp, 0, n-1, k, depth);
+	free(tmp);
+}
+
+/*
+ *	the buffer holds the k best so far and whatever got past the
+ *	threshold since. once it fills up a select cuts it back to k,
+ *	and the smallest of those is the new threshold: on most streams
+ *	it soon rises to where the filter lets next to nothing through.
+ */
+Topk *
+topkinit(int64 k)
+{
+	Topk *t;
+
+	if(k < 1)
+		return NULL;
+	t = malloc(sizeof t[0]);
+	if(t == NULL)
+		return NULL;
+	memset(t, 0, sizeof t[0]);
+	t->k = k;
+	t->cap = k + Nroom;
+	t->buf = malloc(t->cap * sizeof t->buf[0]);
+	if(t->buf == NULL){
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+static void
+topkcut(Topk *t)
+{
+	int64 d;
+
+	if(t->n <= t->k)
+		return;
+	d = t->n - t->k;
+	nthi32(t->buf, t->n, d);
+	memmove(t->buf, t->buf+d, t->k * sizeof t->buf[0]);
+	t->n = t->k;
+	t->thr = t->buf[0];
+	t->full = 1;
+}
+
+void
+topkadd(Topk *t, int32 *a, int64 n)
+{
+	int64 m;
+
+	while(n > 0){
+		m = t->cap - t->n;
+		if(m > n)
+			m = n;
+		if(t->full){
+			t->n += simdsort()->filter(t->buf + t->n, a, m, t->thr);
+		} else {
+			memcpy(t->buf + t->n, a, m * sizeof a[0]);
+			t->n += m;
+		}
+		a += m;
+		n -= m;
+		if(t->cap - t->n < Nroom/2)
+			topkcut(t);
+	}
+}
+
+int64
+topkget(Topk *t, int32 *out)
+{
+	topkcut(t);
+	memcpy(out, t->buf, t->n * sizeof out[0]);
+	bitonsorti32(out, t->n);
+	return t->n;
+}
+
+void
+topkfree(Topk *t)
+{
+	free(t->buf);
+	free(t);
+}
+
+/*
+ *	each round every rank offers the median of the keys it still
+ *	has in play, weighted by how many those are. the weighted median
+ *	of the medians has a quarter of the keys in play on either side,
+ *	so a three way split around it and an allreduce of the counts
+ *	drop at least that many, and the answer shows up in O(log n)
+ *	rounds of a few allreduces each.
+ */
+int32
+cubenthi32(int32 *a, int64 n, int64 k)
+{
+	int32 *tmp;
+	double *v, w[2];
+	double total, sum;
+	int64 lo, hi, c, nlt, neq;
+	int32 t;
+	int i, j, p;
+
+	p = cube_nranks;
+	v = malloc(2 * p * sizeof v[0]);
+	tmp = malloc((n > 0 ? n : 1) * sizeof tmp[0]);
+	if(v == NULL || tmp == NULL){
+		fprintf(stderr, "%d: cubenthi32: cannot allocate %lld keys\n", cube_id, n);
+		exit(1);
+	}
+	lo = 0;
+	hi = n;
+	t = 0;
+	for(;;){
+		memset(v, 0, 2 * p * sizeof v[0]);
+		c = hi - lo;
+		if(c > 0){
+			nthi32(a+lo, c, c/2);
+			v[2*cube_id] = a[lo+c/2];
+			v[2*cube_id+1] = c;
+		}
+		cubeallreduce(v, 2*p, Rsum);
+
+		/* insertion sort of the medians by key, carrying weights */
+		for(i = 1; i < p; i++){
+			for(j = i; j > 0 && v[2*j-2] > v[2*j]; j--){
+				w[0] = v[2*j-2];
+				w[1] = v[2*j-1];
+				v[2*j-2] = v[2*j];
+				v[2*j-1] = v[2*j+1];
+				v[2*j] = w[0];
+				v[2*j+1] = w[1];
+			}
+		}
+		total = 0.0;
+		for(i = 0; i < p; i++)
+			total += v[2*i+1];
+		if(total == 0.0)
+			break;
+		sum = 0.0;
+		for(i = 0; i < p; i++){
+			sum += v[2*i+1];
+			if(v[2*i+1] > 0.0 && 2*sum >= total)
+				break;
+		}
+		t = v[2*i];
+
+		nlt = neq = 0;
+		if(c > 0)
+			nlt = partitioni32(a+lo, tmp, c, t, &neq);
+		w[0] = nlt;
+		w[1] = neq;
+		cubeallreduce(w, 2, Rsum);
+		if(k < w[0]){
+			hi = lo + nlt;
+		} else if(k < w[0] + w[1]){
+			break;
+		} else {
+			k -= w[0] + w[1];
+			lo += nlt + neq;
+		}
+	}
+	free(tmp);
+	free(v);
+	return t;
+}
@@ -0,0 +1,58 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Topk Topk;
+
+/*
+ *	selection on int32 keys, in select.c:
+ *
+ *	nthi32(a, n, k)			puts the k-th smallest key (from 0) at a[k],
+ *					smaller or equal ones before it, larger or
+ *					equal after, like c++ nth_element
+ *	partitioni32(a, tmp, n, t, neq)	three way partition around t through
+ *					tmp, returns the count below t, neq
+ *					gets the count equal to t
+ *	cubenthi32(a, n, k)		the k-th smallest of the keys of all
+ *					ranks, each holding n of them in a,
+ *					which gets reordered. every rank gets
+ *					the key, no data is gathered
+ *
+ *	topk keeps the k largest keys of a stream that comes in chunks
+ *	of any size. topkget hands them out in ascending order and
+ *	returns how many there are, fewer than k for a short stream.
+ */
+struct Topk {
+	int64 k;
+	int32 *buf;
+	int64 n;
+	int64 cap;
+	int32 thr;
+	int full;
+};
+
+void nthi32(int32 *a, int64 n, int64 k);
+int64 partitioni32(int32 *a, int32 *tmp, int64 n, int32 t, int64 *neq);
+int32 cubenthi32(int32 *a, int64 n, int64 k);
+
+Topk *topkinit(int64 k);
+void topkadd(Topk *t, int32 *a, int64 n);
+int64 topkget(Topk *t, int32 *out);
+void topkfree(Topk *t);
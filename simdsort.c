@@ -0,0 +1,502 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "simdsort.h"
+
+#include <immintrin.h>
+
+enum {
+	Ntile = 32*1024,	/* keys sorted in cache, 128k */
+};
+
+static void
+nopblk(int *a, int up)
+{
+}
+
+static void
+cmpx1(int *a, int *b, int64 n, int up)
+{
+	int64 i;
+	int x, y;
+	for(i = 0; i < n; i++){
+		x = a[i];
+		y = b[i];
+		a[i] = (x < y) == up ? x : y;
+		b[i] = (x < y) == up ? y : x;
+	}
+}
+
+/*
+ *	three way partition of src into dst around t: keys below t
+ *	from the front, keys above t from the back, and the hole in
+ *	between filled with t. both ends are written for every key,
+ *	which is always into free space, so nothing branches on keys.
+ */
+static int64
+part1(int *dst, int *src, int64 n, int t, int64 *neq)
+{
+	int64 i, l, r;
+	int x;
+
+	l = 0;
+	r = n-1;
+	for(i = 0; i < n; i++){
+		x = src[i];
+		dst[l] = x;
+		dst[r] = x;
+		l += x < t;
+		r -= x > t;
+	}
+	for(i = l; i <= r; i++)
+		dst[i] = t;
+	*neq = r-l+1;
+	return l;
+}
+
+/*
+ *	the keys of src above t, to dst. returns how many.
+ */
+static int64
+filter1(int *dst, int *src, int64 n, int t)
+{
+	int64 i, m;
+
+	m = 0;
+	for(i = 0; i < n; i++){
+		dst[m] = src[i];
+		m += src[i] > t;
+	}
+	return m;
+}
+
+/*
+ *	in-register compare-exchange of lane l with lane l^k. the lane
+ *	keeps the maximum when exactly one of (l&k), (l&s) and down is
+ *	set: s is the size of the bitonic sequences being merged, so
+ *	passing s = width gives one direction for the whole register.
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+cmpx8(__m256i v, int k, int s, int down)
+{
+	__m256i lane, w, mn, mx, t1, t2, mask;
+
+	lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	w = _mm256_permutevar8x32_epi32(v, _mm256_xor_si256(lane, _mm256_set1_epi32(k)));
+	mn = _mm256_min_epi32(v, w);
+	mx = _mm256_max_epi32(v, w);
+	t1 = _mm256_cmpeq_epi32(_mm256_and_si256(lane, _mm256_set1_epi32(k)), _mm256_setzero_si256());
+	t2 = _mm256_cmpeq_epi32(_mm256_and_si256(lane, _mm256_set1_epi32(s)), _mm256_setzero_si256());
+	mask = _mm256_xor_si256(t1, t2);
+	if(down)
+		mask = _mm256_xor_si256(mask, _mm256_set1_epi32(-1));
+	return _mm256_blendv_epi8(mn, mx, mask);
+}
+
+__attribute__((target("avx2")))
+static void
+mergeblk8(int *a, int up)
+{
+	__m256i v;
+	v = _mm256_loadu_si256((__m256i *)a);
+	v = cmpx8(v, 4, 8, !up);
+	v = cmpx8(v, 2, 8, !up);
+	v = cmpx8(v, 1, 8, !up);
+	_mm256_storeu_si256((__m256i *)a, v);
+}
+
+__attribute__((target("avx2")))
+static void
+sortblk8(int *a, int up)
+{
+	__m256i v;
+	v = _mm256_loadu_si256((__m256i *)a);
+	v = cmpx8(v, 1, 2, !up);
+	v = cmpx8(v, 2, 4, !up);
+	v = cmpx8(v, 1, 4, !up);
+	v = cmpx8(v, 4, 8, !up);
+	v = cmpx8(v, 2, 8, !up);
+	v = cmpx8(v, 1, 8, !up);
+	_mm256_storeu_si256((__m256i *)a, v);
+}
+
+__attribute__((target("avx2")))
+static void
+cmpxavx2(int *a, int *b, int64 n, int up)
+{
+	__m256i x, y, mn, mx;
+	int64 i;
+
+	for(i = 0; i+8 <= n; i += 8){
+		x = _mm256_loadu_si256((__m256i *)(a+i));
+		y = _mm256_loadu_si256((__m256i *)(b+i));
+		mn = _mm256_min_epi32(x, y);
+		mx = _mm256_max_epi32(x, y);
+		_mm256_storeu_si256((__m256i *)(a+i), up ? mn : mx);
+		_mm256_storeu_si256((__m256i *)(b+i), up ? mx : mn);
+	}
+	cmpx1(a+i, b+i, n-i, up);
+}
+
+/*
+ *	avx2 has no compress, so a table gives the permutation that
+ *	packs the lanes of a mask to the front, or to the back.
+ */
+static int permlo[256][8];
+static int permhi[256][8];
+
+static void
+perminit(void)
+{
+	int m, l, j;
+
+	for(m = 0; m < 256; m++){
+		j = 0;
+		for(l = 0; l < 8; l++)
+			if(m & (1<<l))
+				permlo[m][j++] = l;
+		for(l = 0; l < 8; l++)
+			if((m & (1<<l)) == 0)
+				permlo[m][j++] = l;
+		j = 7;
+		for(l = 7; l >= 0; l--)
+			if(m & (1<<l))
+				permhi[m][j--] = l;
+		for(l = 7; l >= 0; l--)
+			if((m & (1<<l)) == 0)
+				permhi[m][j--] = l;
+	}
+}
+
+/*
+ *	whole registers go to both ends, so the vector loop stops while
+ *	the free space in between still holds two of them.
+ */
+__attribute__((target("avx2,popcnt")))
+static int64
+partavx2(int *dst, int *src, int64 n, int t, int64 *neq)
+{
+	__m256i v, tv;
+	int64 i, l, r;
+	int lt, gt;
+
+	tv = _mm256_set1_epi32(t);
+	l = 0;
+	r = n-1;
+	for(i = 0; i+16 <= n; i += 8){
+		v = _mm256_loadu_si256((__m256i *)(src+i));
+		lt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(tv, v)));
+		gt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, tv)));
+		_mm256_storeu_si256((__m256i *)(dst+l),
+			_mm256_permutevar8x32_epi32(v, _mm256_loadu_si256((__m256i *)permlo[lt])));
+		_mm256_storeu_si256((__m256i *)(dst+r-7),
+			_mm256_permutevar8x32_epi32(v, _mm256_loadu_si256((__m256i *)permhi[gt])));
+		l += _mm_popcnt_u32(lt);
+		r -= _mm_popcnt_u32(gt);
+	}
+	for(; i < n; i++){
+		if(src[i] < t)
+			dst[l++] = src[i];
+		else if(src[i] > t)
+			dst[r--] = src[i];
+	}
+	for(i = l; i <= r; i++)
+		dst[i] = t;
+	*neq = r-l+1;
+	return l;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int64
+filteravx2(int *dst, int *src, int64 n, int t)
+{
+	__m256i v, tv;
+	int64 i, m;
+	int gt;
+
+	tv = _mm256_set1_epi32(t);
+	m = 0;
+	for(i = 0; i+8 <= n; i += 8){
+		v = _mm256_loadu_si256((__m256i *)(src+i));
+		gt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, tv)));
+		if(gt == 0)
+			continue;
+		_mm256_storeu_si256((__m256i *)(dst+m),
+			_mm256_permutevar8x32_epi32(v, _mm256_loadu_si256((__m256i *)permlo[gt])));
+		m += _mm_popcnt_u32(gt);
+	}
+	return m + filter1(dst+m, src+i, n-i, t);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i
+cmpx16(__m512i v, int k, int s, int down)
+{
+	__m512i lane, w, mn, mx;
+	__mmask16 mask;
+	int l;
+
+	lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	w = _mm512_permutexvar_epi32(_mm512_xor_si512(lane, _mm512_set1_epi32(k)), v);
+	mn = _mm512_min_epi32(v, w);
+	mx = _mm512_max_epi32(v, w);
+	mask = 0;
+	for(l = 0; l < 16; l++)
+		if(((l & k) != 0) ^ ((l & s) != 0) ^ down)
+			mask |= 1 << l;
+	return _mm512_mask_blend_epi32(mask, mn, mx);
+}
+
+__attribute__((target("avx512f")))
+static void
+mergeblk16(int *a, int up)
+{
+	__m512i v;
+	v = _mm512_loadu_si512(a);
+	v = cmpx16(v, 8, 16, !up);
+	v = cmpx16(v, 4, 16, !up);
+	v = cmpx16(v, 2, 16, !up);
+	v = cmpx16(v, 1, 16, !up);
+	_mm512_storeu_si512(a, v);
+}
+
+__attribute__((target("avx512f")))
+static void
+sortblk16(int *a, int up)
+{
+	__m512i v;
+	int s, k;
+	v = _mm512_loadu_si512(a);
+	for(s = 2; s <= 16; s *= 2)
+		for(k = s/2; k > 0; k /= 2)
+			v = cmpx16(v, k, s, !up);
+	_mm512_storeu_si512(a, v);
+}
+
+__attribute__((target("avx512f")))
+static void
+cmpxavx512(int *a, int *b, int64 n, int up)
+{
+	__m512i x, y, mn, mx;
+	int64 i;
+
+	for(i = 0; i+16 <= n; i += 16){
+		x = _mm512_loadu_si512(a+i);
+		y = _mm512_loadu_si512(b+i);
+		mn = _mm512_min_epi32(x, y);
+		mx = _mm512_max_epi32(x, y);
+		_mm512_storeu_si512(a+i, up ? mn : mx);
+		_mm512_storeu_si512(b+i, up ? mx : mn);
+	}
+	cmpx1(a+i, b+i, n-i, up);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int64
+partavx512(int *dst, int *src, int64 n, int t, int64 *neq)
+{
+	__m512i v, tv;
+	__mmask16 lt, gt;
+	int64 i, l, r;
+
+	tv = _mm512_set1_epi32(t);
+	l = 0;
+	r = n;
+	for(i = 0; i+16 <= n; i += 16){
+		v = _mm512_loadu_si512(src+i);
+		lt = _mm512_cmplt_epi32_mask(v, tv);
+		gt = _mm512_cmpgt_epi32_mask(v, tv);
+		_mm512_mask_compressstoreu_epi32(dst+l, lt, v);
+		l += _mm_popcnt_u32(lt);
+		r -= _mm_popcnt_u32(gt);
+		_mm512_mask_compressstoreu_epi32(dst+r, gt, v);
+	}
+	for(; i < n; i++){
+		if(src[i] < t)
+			dst[l++] = src[i];
+		else if(src[i] > t)
+			dst[--r] = src[i];
+	}
+	for(i = l; i < r; i++)
+		dst[i] = t;
+	*neq = r-l;
+	return l;
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int64
+filteravx512(int *dst, int *src, int64 n, int t)
+{
+	__m512i v, tv;
+	__mmask16 gt;
+	int64 i, m;
+
+	tv = _mm512_set1_epi32(t);
+	m = 0;
+	for(i = 0; i+16 <= n; i += 16){
+		v = _mm512_loadu_si512(src+i);
+		gt = _mm512_cmpgt_epi32_mask(v, tv);
+		_mm512_mask_compressstoreu_epi32(dst+m, gt, v);
+		m += _mm_popcnt_u32(gt);
+	}
+	return m + filter1(dst+m, src+i, n-i, t);
+}
+
+static Simdsort simdtab[] = {
+	{ "avx512", 16, sortblk16, mergeblk16, cmpxavx512, partavx512, filteravx512 },
+	{ "avx2", 8, sortblk8, mergeblk8, cmpxavx2, partavx2, filteravx2 },
+	{ "scalar", 1, nopblk, nopblk, cmpx1, part1, filter1 },
+};
+
+/*
+ *	the widest kernel this cpu runs, unless SIMDSORT names a
+ *	narrower one (avx512, avx2 or scalar) for comparison runs.
+ */
+Simdsort *
+simdsort(void)
+{
+	static Simdsort *ss;
+	char *want;
+	int i;
+
+	if(ss != NULL)
+		return ss;
+
+	__builtin_cpu_init();
+	want = getenv("SIMDSORT");
+	for(i = 0; i < nelem(simdtab); i++){
+		if(want != NULL && strcmp(want, simdtab[i].name) != 0)
+			continue;
+		if(simdtab[i].width == 16 && !__builtin_cpu_supports("avx512f"))
+			continue;
+		if(simdtab[i].width == 8 && !__builtin_cpu_supports("avx2"))
+			continue;
+		break;
+	}
+	if(i == nelem(simdtab))
+		i = nelem(simdtab)-1;
+	if(simdtab[i].width == 8)
+		perminit();
+	ss = &simdtab[i];
+	return ss;
+}
+
+static int
+ispow2(int64 n)
+{
+	return (n & (n-1)) == 0;
+}
+
+/*
+ *	the plain network of the scalar driver in sort.c on a power of
+ *	two block: the first log2(width) stages happen inside registers,
+ *	and every merge finishes its last log2(width) strides there too.
+ *	the callers only hand it blocks that fit in cache, so all of its
+ *	log2(n)^2/2 stages run back to back on resident data.
+ */
+static void
+sorttile(Simdsort *ss, int *a, int64 n, int up)
+{
+	int64 i, j, s, t, w;
+	int dir;
+
+	w = ss->width;
+	for(i = 0; i < n; i += w)
+		ss->sortblk(a+i, ((i & w) == 0) == up);
+	for(s = 2*w; s <= n; s *= 2){
+		for(i = 0; i < n; i += s){
+			dir = ((i & s) == 0) == up;
+			for(t = s/2; t >= w; t /= 2)
+				for(j = 0; j < s; j += 2*t)
+					ss->cmpx(a+i+j, a+i+j+t, t, dir);
+			for(j = 0; j < s; j += w)
+				ss->mergeblk(a+i+j, dir);
+		}
+	}
+}
+
+static void
+mergetile(Simdsort *ss, int *a, int64 n, int up)
+{
+	int64 i, t, w;
+
+	w = ss->width;
+	for(t = n/2; t >= w; t /= 2)
+		for(i = 0; i < n; i += 2*t)
+			ss->cmpx(a+i, a+i+t, t, up);
+	for(i = 0; i < n; i += w)
+		ss->mergeblk(a+i, up);
+}
+
+/*
+ *	bitonic merge for any n: compare-exchange the head with the
+ *	tail across the largest power of two below n, then merge both
+ *	sides. each level above the tile is one pass over memory, the
+ *	rest happens in cache.
+ */
+static void
+bmerge(Simdsort *ss, int *a, int64 n, int up)
+{
+	int64 m;
+
+	if(n <= 1)
+		return;
+	if(n >= ss->width && n <= Ntile && ispow2(n)){
+		mergetile(ss, a, n, up);
+		return;
+	}
+	for(m = 1; 2*m < n; m *= 2)
+		;
+	ss->cmpx(a, a+m, n-m, up);
+	bmerge(ss, a, m, up);
+	bmerge(ss, a+m, n-m, up);
+}
+
+static void
+bsort(Simdsort *ss, int *a, int64 n, int up)
+{
+	int64 m;
+
+	if(n <= 1)
+		return;
+	if(n >= ss->width && n <= Ntile && ispow2(n)){
+		sorttile(ss, a, n, up);
+		return;
+	}
+	m = n/2;
+	bsort(ss, a, m, !up);
+	bsort(ss, a+m, n-m, up);
+	bmerge(ss, a, n, up);
+}
+
+/*
+ *	depth first, so every block is sorted completely while it is
+ *	still in cache, and only the merges above Ntile keys stream
+ *	through memory: O(log2(n/Ntile)^2) passes instead of
+ *	O(log2(n)^2). n need not be a power of two.
+ */
+void
+simdbitonsort(int *arr, int64 n)
+{
+	bsort(simdsort(), arr, n, 1);
+}
@@ -0,0 +1,46 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Simdsort Simdsort;
+
+/*
+ *	the building blocks of a bitonic network on int keys.
+ *	sortblk sorts width keys, mergeblk finishes a bitonic sequence
+ *	of width keys, cmpx compare-exchanges a[i] with b[i] for i < n.
+ *	up keeps the smaller key in front.
+ *
+ *	and of selection: part copies src to dst with the keys below t
+ *	first, those above t last and t in between, returning how many
+ *	are below and setting neq to how many equal t. filter copies
+ *	the keys above t and returns how many.
+ */
+struct Simdsort {
+	char *name;
+	int width;
+	void (*sortblk)(int *a, int up);
+	void (*mergeblk)(int *a, int up);
+	void (*cmpx)(int *a, int *b, int64 n, int up);
+	int64 (*part)(int *dst, int *src, int64 n, int t, int64 *neq);
+	int64 (*filter)(int *dst, int *src, int64 n, int t);
+};
+
+Simdsort *simdsort(void);
+void simdbitonsort(int *arr, int64 n);
@@ -20,6 +20,41 @@
  *	THE SOFTWARE.
  */
 #include "os.h"
+#include "cube.h"
+#include "simdsort.h"
+#include "pool.h"
+#include "sortlib.h"
+#include "select.h"
+
+enum {
+	Ndim = 6,
+	Nreps = 5,
+	Nwarm = 1,
+	Nmin = 4*1024,		/* 4k keys, 16k bytes, sits in l1 */
+	Nmax = 16*1024*1024,	/* 16m keys, 64m bytes, well past any llc */
+	Nzipf = 1024*1024,	/* distinct zipf keys */
+	Ntopk = 1024,		/* keys kept by the topk engine */
+	Nchunk = 64*1024,	/* and the chunks it is fed in */
+};
+
+typedef struct Engine Engine;
+typedef struct Dist Dist;
+
+struct Engine {
+	char *name;
+	int (*sort)(int *arr, int *tmp, int64 n);	/* -1 if it couldn't run */
+	int pow2;
+	int on;
+	int64 (*check)(int *arr, int *src, int64 n);
+};
+
+struct Dist {
+	char *name;
+	void (*gen)(int *arr, int64 n);
+	int on;
+};
+
+static int csv;
 
 static int
 cmp(const void *ap, const void *bp)
@@ -69,68 +104,601 @@ merge(int *arr, int64 n, int up)
 				cmpswap(arr, up ? i+j : i+j+s, up ? i+j+s : i+j);
 }
 
+static void
+bitonsort(int *arr, int64 n)
+{
+	int64 i, s;
+	for(s = 2; s <= n; s *= 2)
+		for(i = 0; i < n; i += s)
+			merge(arr+i, s, (i & s) == 0);
+}
+
+static int
+cmp64(const void *ap, const void *bp)
+{
+	int64 a, b;
+	a = *(int64 *)ap;
+	b = *(int64 *)bp;
+	if(a < b)
+		return -1;
+	else if(a > b)
+		return 1;
+	return 0;
+}
+
+/*
+ *	one line per engine, distribution and size: the fastest,
+ *	median and 99th percentile of the timed repetitions.
+ */
+static void
+report(char *engine, char *dist, int64 n, int64 *t, int reps)
+{
+	int64 tmin, tmed, tp99;
+
+	qsort(t, reps, sizeof t[0], cmp64);
+	tmin = t[0];
+	tmed = t[reps/2];
+	tp99 = t[(reps*99 + 99)/100 - 1];
+	if(csv){
+		printf("%s,%s,%lld,%d,%.9f,%.9f,%.9f,%.3f\n", engine, dist, n, reps,
+			tmin*1e-9, tmed*1e-9, tp99*1e-9, (double)n / (tmed*1e-6));
+	} else {
+		printf("%-12s %-10s %10lld  min %.6f s  med %.6f s  p99 %.6f s  %.3f kkeys/s\n", engine, dist, n,
+			tmin*1e-9, tmed*1e-9, tp99*1e-9, (double)n / (tmed*1e-6));
+	}
+	fflush(stdout);
+}
+
+/*
+ *	runs in a child of its own, since initcube forks the ranks
+ *	and endcube exits. every rank sorts n keys, or helps find the
+ *	middle one of all of them.
+ */
+static void
+cubebench(int dim, int64 n, int warm, int reps, long seed, int nth)
+{
+	double t[1], c[2], *bounds;
+	int64 times[reps];
+	int *arr, *src;
+	int64 i, start, end;
+	char name[32];
+	int32 key;
+	int r, ok;
+
+	initcube(dim);
+
+	arr = malloc(n * sizeof arr[0]);
+	src = malloc(n * sizeof src[0]);
+	srand48(seed + cube_id);
+	for(i = 0; i < n; i++)
+		src[i] = mrand48();
+
+	ok = 1;
+	for(r = -warm; r < reps; r++){
+		memcpy(arr, src, n * sizeof arr[0]);
+		t[0] = 0.0;
+		cubeallreduce(t, 1, Rsum);
+		start = nsec();
+		if(nth)
+			key = cubenthi32(arr, n, (n << cube_dim)/2);
+		else
+			cubesort(arr, n);
+		end = nsec();
+		t[0] = end-start;
+		cubeallreduce(t, 1, Rmax);
+		if(r >= 0)
+			times[r] = t[0];
+	}
+
+	/* the middle key has half of all keys below or equal to it */
+	if(nth){
+		c[0] = c[1] = 0.0;
+		for(i = 0; i < n; i++){
+			c[0] += src[i] < key;
+			c[1] += src[i] <= key;
+		}
+		cubeallreduce(c, 2, Rsum);
+		if(c[0] > (n << cube_dim)/2 || c[1] <= (n << cube_dim)/2)
+			fprintf(stderr, "%3d: cubenth dim %d picked %d, %.0f below, %.0f not above\n",
+				cube_id, cube_dim, key, c[0], c[1]);
+		if(cube_id == 0){
+			snprintf(name, sizeof name, "cubenth/%d", cube_dim);
+			report(name, "random", n << cube_dim, times, reps);
+		}
+		endcube();
+	}
+
+	/* sorted locally, and ranks in order of cube_id */
+	for(i = 1; i < n; i++)
+		if(arr[i-1] > arr[i])
+			ok = 0;
+	bounds = malloc(2 * (1<<cube_dim) * sizeof bounds[0]);
+	memset(bounds, 0, 2 * (1<<cube_dim) * sizeof bounds[0]);
+	bounds[2*cube_id] = arr[0];
+	bounds[2*cube_id+1] = arr[n-1];
+	cubeallreduce(bounds, 2 * (1<<cube_dim), Rsum);
+	for(i = 1; i < (1<<cube_dim); i++)
+		if(bounds[2*i-1] > bounds[2*i])
+			ok = 0;
+	if(!ok)
+		fprintf(stderr, "%3d: cubesort dim %d out of order\n", cube_id, cube_dim);
+
+	if(cube_id == 0){
+		snprintf(name, sizeof name, "cubesort/%d", cube_dim);
+		report(name, "random", n << cube_dim, times, reps);
+	}
+
+	endcube();
+}
+
+static int
+qsortfn(int *arr, int *tmp, int64 n)
+{
+	qsort(arr, n, sizeof arr[0], cmp);
+	return 0;
+}
+
+static int
+radixfn(int *arr, int *tmp, int64 n)
+{
+	radixsorti32(arr, tmp, n);
+	return 0;
+}
+
+static int
+bitonfn(int *arr, int *tmp, int64 n)
+{
+	bitonsort(arr, n);
+	return 0;
+}
+
+static int
+simdfn(int *arr, int *tmp, int64 n)
+{
+	bitonsorti32(arr, n);
+	return 0;
+}
+
+static int
+parfn(int *arr, int *tmp, int64 n)
+{
+	parsorti32(arr, tmp, n);
+	return 0;
+}
+
+static int
+nthfn(int *arr, int *tmp, int64 n)
+{
+	nthi32(arr, n, n/2);
+	return 0;
+}
+
+/* the top keys end up in front of arr, in ascending order */
+static int
+topkfn(int *arr, int *tmp, int64 n)
+{
+	Topk *t;
+	int64 i, k;
+
+	k = n < Ntopk ? n : Ntopk;
+	t = topkinit(k);
+	if(t == NULL){
+		fprintf(stderr, "topk: cannot allocate for %lld keys\n", k);
+		return -1;
+	}
+	for(i = 0; i < n; i += Nchunk)
+		topkadd(t, arr+i, n-i < Nchunk ? n-i : Nchunk);
+	topkget(t, arr);
+	topkfree(t);
+	return 0;
+}
+
+/* the k-th key sits where sorting would put it, and splits arr */
+static int64
+nthcheck(int *arr, int *src, int64 n)
+{
+	int64 i, k, lt, le, bad;
+
+	k = n/2;
+	bad = 0;
+	for(i = 0; i < n; i++)
+		if(i < k ? arr[i] > arr[k] : arr[i] < arr[k])
+			bad++;
+	lt = le = 0;
+	for(i = 0; i < n; i++){
+		lt += src[i] < arr[k];
+		le += src[i] <= arr[k];
+	}
+	if(lt > k || le <= k)
+		bad++;
+	return bad;
+}
+
+/*
+ *	ascending, the first one is the k-th largest of src, and they
+ *	add up to the sum of the keys of src above it, filled up with
+ *	copies of it.
+ */
+static int64
+topkcheck(int *arr, int *src, int64 n)
+{
+	int64 i, k, gt, ge, bad, sum;
+
+	k = n < Ntopk ? n : Ntopk;
+	bad = 0;
+	for(i = 1; i < k; i++)
+		if(arr[i-1] > arr[i])
+			bad++;
+	gt = ge = sum = 0;
+	for(i = 0; i < n; i++){
+		if(src[i] > arr[0]){
+			gt++;
+			sum += src[i];
+		}
+		ge += src[i] >= arr[0];
+	}
+	if(gt >= k || ge < k)
+		bad++;
+	sum += (k - gt) * arr[0];
+	for(i = 0; i < k; i++)
+		sum -= arr[i];
+	if(sum != 0)
+		bad++;
+	return bad;
+}
+
+static void
+gensorted(int *arr, int64 n)
+{
+	int64 i;
+	for(i = 0; i < n; i++)
+		arr[i] = i;
+}
+
+static void
+genreverse(int *arr, int64 n)
+{
+	int64 i;
+	for(i = 0; i < n; i++)
+		arr[i] = n-1-i;
+}
+
+static void
+genperm(int *arr, int64 n)
+{
+	int64 i;
+	gensorted(arr, n);
+	for(i = 0; i < n; i++)
+		swap(arr, i, lrand48()%n);
+}
+
+static void
+genrandom(int *arr, int64 n)
+{
+	int64 i;
+	for(i = 0; i < n; i++)
+		arr[i] = mrand48();
+}
+
+static void
+genfewuniq(int *arr, int64 n)
+{
+	int64 i;
+	for(i = 0; i < n; i++)
+		arr[i] = lrand48() % 16;
+}
+
+static void
+genorganpipe(int *arr, int64 n)
+{
+	int64 i;
+	for(i = 0; i < n; i++)
+		arr[i] = i < n/2 ? i : n-1-i;
+}
+
+/* sorted, with one percent of the keys swapped at random */
+static void
+genalmost(int *arr, int64 n)
+{
+	int64 i;
+	gensorted(arr, n);
+	for(i = 0; i < n/100; i++)
+		swap(arr, lrand48()%n, lrand48()%n);
+}
+
+/*
+ *	zipf with exponent 1 over Nzipf keys, by inverting the cdf.
+ *	the keys are scattered so rank doesn't equal key order.
+ */
+static void
+genzipf(int *arr, int64 n)
+{
+	static double *cdf;
+	double u, sum;
+	int64 i, lo, hi, mid;
+
+	if(cdf == NULL){
+		cdf = malloc(Nzipf * sizeof cdf[0]);
+		sum = 0.0;
+		for(i = 0; i < Nzipf; i++){
+			sum += 1.0 / (i+1);
+			cdf[i] = sum;
+		}
+		for(i = 0; i < Nzipf; i++)
+			cdf[i] /= sum;
+	}
+	for(i = 0; i < n; i++){
+		u = drand48();
+		lo = 0;
+		hi = Nzipf-1;
+		while(lo < hi){
+			mid = (lo + hi) / 2;
+			if(cdf[mid] < u)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		arr[i] = (uint32)lo * 2654435761u;
+	}
+}
+
+static Engine engines[] = {
+	{ "quicksort", qsortfn, 0, 1 },
+	{ "radixsort", radixfn, 0, 1 },
+	{ "bitonsort", bitonfn, 1, 1 },
+	{ "bitonsimd", simdfn, 0, 1 },
+	{ "parsort", parfn, 0, 1 },
+	{ "nth", nthfn, 0, 1, nthcheck },
+	{ "topk", topkfn, 0, 1, topkcheck },
+	{ "cubesort", NULL, 0, 0 },
+	{ "cubenth", NULL, 0, 0 },
+};
+
+static Dist dists[] = {
+	{ "random", genrandom, 1 },
+	{ "perm", genperm, 1 },
+	{ "sorted", gensorted, 1 },
+	{ "reverse", genreverse, 1 },
+	{ "fewuniq", genfewuniq, 1 },
+	{ "zipf", genzipf, 1 },
+	{ "organpipe", genorganpipe, 1 },
+	{ "almost", genalmost, 1 },
+};
+
+static int64
+parsesize(char *s, char **rp)
+{
+	char *r;
+	int64 n;
+
+	n = strtoll(s, &r, 10);
+	switch(*r){
+	case 'k': case 'K':
+		n *= 1024;
+		r++;
+		break;
+	case 'm': case 'M':
+		n *= 1024*1024;
+		r++;
+		break;
+	case 'g': case 'G':
+		n *= 1024*1024*1024;
+		r++;
+		break;
+	}
+	if(rp != NULL)
+		*rp = r;
+	return n;
+}
+
+static int
+inlist(char *list, char *name)
+{
+	char *p;
+	int n;
+
+	n = strlen(name);
+	for(p = list; p != NULL; p = strchr(p, ',')){
+		if(*p == ',')
+			p++;
+		if(strncmp(p, name, n) == 0 && (p[n] == ',' || p[n] == '\0'))
+			return 1;
+	}
+	return 0;
+}
+
+static void
+usage(void)
+{
+	int i;
+
+	fprintf(stderr, "usage: sort [-c] [-r reps] [-w warmup] [-e engines] [-D dists] [-t threads] [-d maxdim] [n | min-max]\n");
+	fprintf(stderr, "engines:");
+	for(i = 0; i < nelem(engines); i++)
+		fprintf(stderr, " %s", engines[i].name);
+	fprintf(stderr, "\ndists:");
+	for(i = 0; i < nelem(dists); i++)
+		fprintf(stderr, " %s", dists[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
-	int *arr;
-	int64 i, j, s, n;
-	long seed;
+	Engine *e;
+	Dist *d;
+	int *arr, *src, *tmp, *ref;
+	int64 *times;
+	int64 i, n, nmin, nmax;
 	int64 start, end;
+	long seed;
+	char *r, *tlist, *p, *q, name[32];
+	int reps, warm, rep, opt, bad, prof, skip;
+	int dim, maxdim, nthr, ncpu;
+	pid_t pid;
 
 	seed = nsec() % 10000;
 
-	n = 1024*1024;
-	if(argc > 1){
-		char *r;
-		n = strtol(argv[1], &r, 10);
-		if(r != NULL){
-			switch(*r){
-			case 'k': case 'K':
-				n *= 1024;
-				break;
-			case 'm': case 'M':
-				n *= 1024*1024;
-				break;
-			case 'g': case 'G':
-				n *= 1024*1024*1024;
-				break;
-			}
+	nmin = Nmin;
+	nmax = Nmax;
+	reps = Nreps;
+	warm = Nwarm;
+	maxdim = Ndim;
+	tlist = NULL;
+	while((opt = getopt(argc, argv, "cr:w:e:D:t:d:")) != -1){
+		switch(opt){
+		case 'c':
+			csv = 1;
+			break;
+		case 'r':
+			reps = strtol(optarg, NULL, 10);
+			break;
+		case 'w':
+			warm = strtol(optarg, NULL, 10);
+			break;
+		case 'e':
+			for(e = engines; e < engines+nelem(engines); e++)
+				e->on = inlist(optarg, e->name);
+			break;
+		case 'D':
+			for(d = dists; d < dists+nelem(dists); d++)
+				d->on = inlist(optarg, d->name);
+			break;
+		case 't':
+			tlist = optarg;
+			break;
+		case 'd':
+			maxdim = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
 		}
 	}
+	argc -= optind;
+	argv += optind;
+	if(argc > 0){
+		nmin = nmax = parsesize(argv[0], &r);
+		if(*r == '-')
+			nmax = parsesize(r+1, NULL);
+	}
+	if(reps < 1 || warm < 0 || nmin < 1 || nmax < nmin)
+		usage();
 
-	arr = malloc(n * sizeof arr[0]);
-	memset(arr, 0, n * sizeof arr[0]);
-	for(i = 0; i < n; i++)
-		arr[i] = i;
+	arr = malloc(nmax * sizeof arr[0]);
+	src = malloc(nmax * sizeof src[0]);
+	tmp = malloc(nmax * sizeof tmp[0]);
+	ref = malloc(nmax * sizeof ref[0]);
+	times = malloc(reps * sizeof times[0]);
 
-	for(j = 0; j < 10; j++){
-		srand48(seed);
-		for(i = 0; i < n; i++)
-			swap(arr, i, lrand48()%n);
+	if(csv)
+		printf("engine,dist,n,reps,min_s,median_s,p99_s,kkeys_per_s\n");
+	else
+		printf("simd %s, %d reps after %d warm-up\n", simdsort()->name, reps, warm);
 
-		start = nsec();
-		qsort(arr, n, sizeof arr[0], cmp);
-		end = nsec();
-
-		for(i = 1; i < n; i++)
-			if(arr[i-1] != arr[i]-1)
-				printf("quicksort %d %d\n",arr[i-1],arr[i]);
-		printf("quicksort %.4f s, %.3f kkeys/s\n", ((end-start)*1e-9), (double)n / ((end-start)*1e-6));
+	/* parsort scales over 1, 2, 4 .. ncpu threads unless told */
+	if(tlist == NULL){
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		tlist = malloc(16 * 32);
+		tlist[0] = '\0';
+		for(nthr = 1; nthr < ncpu; nthr *= 2)
+			sprintf(tlist + strlen(tlist), "%d,", nthr);
+		sprintf(tlist + strlen(tlist), "%d", ncpu);
+	}
 
-		srand48(seed);
-		for(i = 0; i < n; i++)
-			swap(arr, i, lrand48()%n);
+	/* sizes go up by four, from cache resident to dram bound */
+	for(n = nmin;; n *= 4){
+		if(n > nmax)
+			n = nmax;
+		for(d = dists; d < dists+nelem(dists); d++){
+			if(!d->on)
+				continue;
+			srand48(seed);
+			d->gen(src, n);
+			/* what every sort must come up with, lost keys and all */
+			memcpy(ref, src, n * sizeof ref[0]);
+			qsort(ref, n, sizeof ref[0], cmp);
+			for(e = engines; e < engines+nelem(engines); e++){
+				if(!e->on || e->sort == NULL)
+					continue;
+				if(e->pow2 && (n & (n-1)) != 0)
+					continue;
 
-		start = nsec();
-		for(s = 2; s <= n; s *= 2)
-			for(i = 0; i < n; i += s)
-				merge(arr+i, s, (i & s) == 0);
-		end = nsec();
+				/* parsort runs once per thread count */
+				p = NULL;
+				if(e->sort == parfn)
+					p = strdup(tlist);
+				q = p;
+				do {
+					nthr = 0;
+					if(p != NULL){
+						nthr = strtol(strsep(&q, ","), NULL, 10);
+						poolinit(nthr);
+					}
+					if(nthr > 0)
+						snprintf(name, sizeof name, "%s/%d", e->name, nthr);
+					else
+						snprintf(name, sizeof name, "%s", e->name);
+					/* counters add up over all sizes and distributions */
+					prof = profregion(name);
+					bad = 0;
+					skip = 0;
+					for(rep = -warm; rep < reps && !skip; rep++){
+						memcpy(arr, src, n * sizeof arr[0]);
+						/* the warm-up is left out of the counters, as of the times */
+						if(rep >= 0)
+							profbegin(prof);
+						start = nsec();
+						skip = e->sort(arr, tmp, n) == -1;
+						end = nsec();
+						if(rep >= 0){
+							profend(prof);
+							times[rep] = end-start;
+						}
+					}
+					/* a skipped engine left arr as it was, there is nothing to check */
+					if(skip)
+						bad = 0;
+					else if(e->check != NULL)
+						bad = e->check(arr, src, n);
+					else for(i = 0; i < n; i++)
+						if(arr[i] != ref[i])
+							bad++;
+					if(bad)
+						fprintf(stderr, "%s %s %lld: %d keys out of place\n", e->name, d->name, n, bad);
+					if(nthr > 0)
+						poolend();
+					if(!skip)
+						report(name, d->name, n, times, reps);
+				} while(q != NULL);
+				free(p);
+			}
+		}
+		if(n == nmax)
+			break;
+	}
 
-		for(i = 1; i < n; i++)
-			if(arr[i-1] != arr[i]-1)
-				printf("bitonsort %d %d\n",arr[i-1],arr[i]);
-		printf("bitonsort %.4f s, %.3f kkeys/s\n", ((end-start)*1e-9), (double)n / ((end-start)*1e-6));
+	/* n keys per rank, so the total grows with the cube */
+	for(e = engines; e < engines+nelem(engines); e++){
+		if(!e->on || e->sort != NULL)
+			continue;
+		for(n = nmin;; n *= 4){
+			if(n > nmax)
+				n = nmax;
+			for(dim = 0; dim <= maxdim; dim++){
+				fflush(stdout);
+				pid = fork();
+				if(pid == -1){
+					fprintf(stderr, "fork: %s\n", strerror(errno));
+					break;
+				}
+				if(pid == 0)
+					cubebench(dim, n, warm, reps, seed, strcmp(e->name, "cubenth") == 0);
+				waitpid(pid, NULL, 0);
+			}
+			if(n == nmax)
+				break;
+		}
 	}
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,310 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+/*
+ *	the sort engines, instantiated by sortlib.c for each key type.
+ *	before including this, define
+ *
+ *	X		the name suffix
+ *	T		the element type
+ *	U		an unsigned integer as wide as the key
+ *	RKEY(x)		the key of x as a U that sorts in unsigned order
+ *	LESS(x, y)	x sorts before y
+ *	BITON(a, n)	optional faster network for this type
+ */
+#define CAT(a, b) a##b
+#define XCAT(a, b) CAT(a, b)
+#define F(name) XCAT(name, X)
+
+#ifndef BITON
+static void
+F(cmpx)(T *a, T *b, int64 n, int up)
+{
+	int64 i;
+	T x, y;
+	for(i = 0; i < n; i++){
+		x = a[i];
+		y = b[i];
+		if(LESS(y, x) == up){
+			a[i] = y;
+			b[i] = x;
+		}
+	}
+}
+
+static void
+F(bmerge)(T *a, int64 n, int up)
+{
+	int64 m;
+
+	if(n <= 1)
+		return;
+	for(m = 1; 2*m < n; m *= 2)
+		;
+	F(cmpx)(a, a+m, n-m, up);
+	F(bmerge)(a, m, up);
+	F(bmerge)(a+m, n-m, up);
+}
+
+static void
+F(bsort)(T *a, int64 n, int up)
+{
+	int64 m;
+
+	if(n <= 1)
+		return;
+	m = n/2;
+	F(bsort)(a, m, !up);
+	F(bsort)(a+m, n-m, up);
+	F(bmerge)(a, n, up);
+}
+#endif
+
+/*
+ *	the recursive network of simdsort.c without the vector kernels.
+ *	it goes depth first, so it is just as cache friendly.
+ */
+void
+F(bitonsort)(T *a, int64 n)
+{
+#ifdef BITON
+	BITON(a, n);
+#else
+	F(bsort)(a, n, 1);
+#endif
+}
+
+/*
+ *	see radixsort in sortlib.c. payloads ride along in the element,
+ *	the write combining lines hold whole elements.
+ */
+void
+F(radixsort)(T *a, T *tmp, int64 n)
+{
+	enum { Npass = (8*sizeof(U) + Nbits-1) / Nbits, Nwc = Nline/sizeof(T) };
+	int64 hist[Npass][Nbucket];
+	T wc[Nbucket][Nwc] __attribute__((aligned(Nline)));
+	int64 off[Nbucket];
+	int fill[Nbucket];
+	int lo[Nbucket];
+	T *src, *dst, *t;
+	U k;
+	int64 i, sum, c;
+	int p, b, shift;
+
+	if(n <= 1)
+		return;
+	memset(hist, 0, sizeof hist);
+	for(i = 0; i < n; i++){
+		k = RKEY(a[i]);
+		for(p = 0; p < Npass; p++)
+			hist[p][(k >> (p*Nbits)) & (Nbucket-1)]++;
+	}
+
+	src = a;
+	dst = tmp;
+	for(p = 0; p < Npass; p++){
+		shift = p*Nbits;
+		if(hist[p][(RKEY(a[0]) >> shift) & (Nbucket-1)] == n)
+			continue;
+		sum = 0;
+		for(b = 0; b < Nbucket; b++){
+			off[b] = sum;
+			sum += hist[p][b];
+			/*
+			 *	the buffer mirrors the destination line, so full
+			 *	flushes are whole aligned lines. the first one
+			 *	starts at lo, where the bucket does.
+			 */
+			lo[b] = (uintptr_t)(dst + off[b]) % Nline / sizeof(T);
+			off[b] -= lo[b];
+			fill[b] = lo[b];
+		}
+		for(i = 0; i < n; i++){
+			b = (RKEY(src[i]) >> shift) & (Nbucket-1);
+			wc[b][fill[b]++] = src[i];
+			if(fill[b] == Nwc){
+				if(lo[b] == 0){
+					memcpy(dst + off[b], wc[b], Nwc * sizeof(T));
+				} else {
+					memcpy(dst + off[b] + lo[b], wc[b] + lo[b], (Nwc - lo[b]) * sizeof(T));
+					lo[b] = 0;
+				}
+				off[b] += Nwc;
+				fill[b] = 0;
+			}
+		}
+		for(b = 0; b < Nbucket; b++){
+			c = fill[b] - lo[b];
+			if(c > 0)
+				memcpy(dst + off[b] + lo[b], wc[b] + lo[b], c * sizeof(T));
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if(src != a)
+		memcpy(a, src, n * sizeof a[0]);
+}
+
+typedef struct {
+	T *a;
+	T *t;
+	int64 n;
+	int totmp;
+} F(Psort);
+
+typedef struct {
+	T *x;
+	int64 nx;
+	T *y;
+	int64 ny;
+	T *d;
+} F(Pmerge);
+
+static void
+F(merge)(T *x, int64 nx, T *y, int64 ny, T *d)
+{
+	int64 i, j, k;
+
+	i = j = k = 0;
+	while(i < nx && j < ny)
+		d[k++] = LESS(y[j], x[i]) ? y[j++] : x[i++];
+	while(i < nx)
+		d[k++] = x[i++];
+	while(j < ny)
+		d[k++] = y[j++];
+}
+
+static int64
+F(lowerbound)(T *y, int64 ny, T key)
+{
+	int64 lo, hi, mid;
+
+	lo = 0;
+	hi = ny;
+	while(lo < hi){
+		mid = lo + (hi-lo)/2;
+		if(LESS(y[mid], key))
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ *	split the longer run at its middle, find where that key goes
+ *	in the shorter one, and merge the two halves in parallel.
+ */
+static void
+F(pmerge)(void *v)
+{
+	F(Pmerge) *m = v, sw, lo, hi;
+	Join j;
+	int64 mx, my;
+
+	if(m->nx < m->ny){
+		sw = (F(Pmerge)){ m->y, m->ny, m->x, m->nx, m->d };
+		m = &sw;
+	}
+	if(m->nx + m->ny <= Nmerge){
+		F(merge)(m->x, m->nx, m->y, m->ny, m->d);
+		return;
+	}
+	mx = m->nx / 2;
+	my = F(lowerbound)(m->y, m->ny, m->x[mx]);
+	m->d[mx+my] = m->x[mx];
+
+	lo = (F(Pmerge)){ m->x, mx, m->y, my, m->d };
+	hi = (F(Pmerge)){ m->x+mx+1, m->nx-mx-1, m->y+my, m->ny-my, m->d+mx+my+1 };
+	memset(&j, 0, sizeof j);
+	poolspawn(&j, F(pmerge), &hi);
+	F(pmerge)(&lo);
+	poolwait(&j);
+}
+
+/*
+ *	merge sort with the halves sorted in parallel. the result goes
+ *	to a or, with totmp set, to t; the halves are sorted into the
+ *	other buffer so the merge never needs a third one.
+ */
+static void
+F(psort)(void *v)
+{
+	F(Psort) *p = v, lo, hi;
+	F(Pmerge) m;
+	Join j;
+	int64 h;
+
+	if(p->n <= Nleaf){
+		F(radixsort)(p->a, p->t, p->n);
+		if(p->totmp)
+			memcpy(p->t, p->a, p->n * sizeof p->a[0]);
+		return;
+	}
+	h = p->n / 2;
+	lo = (F(Psort)){ p->a, p->t, h, !p->totmp };
+	hi = (F(Psort)){ p->a+h, p->t+h, p->n-h, !p->totmp };
+	memset(&j, 0, sizeof j);
+	poolspawn(&j, F(psort), &hi);
+	F(psort)(&lo);
+	poolwait(&j);
+
+	if(p->totmp)
+		m = (F(Pmerge)){ p->a, h, p->a+h, p->n-h, p->t };
+	else
+		m = (F(Pmerge)){ p->t, h, p->t+h, p->n-h, p->a };
+	F(pmerge)(&m);
+}
+
+void
+F(parsort)(T *a, T *tmp, int64 n)
+{
+	F(Psort) p;
+
+	if(poolthreads() == 0){
+		F(radixsort)(a, tmp, n);
+		return;
+	}
+	p = (F(Psort)){ a, tmp, n, 0 };
+	F(psort)(&p);
+}
+
+int
+F(sort)(T *a, int64 n)
+{
+	T *tmp;
+
+	tmp = malloc(n * sizeof tmp[0]);
+	if(tmp == NULL)
+		return -1;
+	if(poolthreads() > 1 && n > Nleaf)
+		F(parsort)(a, tmp, n);
+	else
+		F(radixsort)(a, tmp, n);
+	free(tmp);
+	return 0;
+}
+
+#undef F
+#undef XCAT
+#undef CAT
@@ -0,0 +1,159 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "pool.h"
+#include "simdsort.h"
+#include "sortlib.h"
+
+enum {
+	Nbits = 8,
+	Nbucket = 1<<Nbits,
+	Nline = 64,
+
+	Nleaf = 64*1024,	/* elements radix sorted by one thread */
+	Nmerge = 32*1024,	/* elements merged by one thread */
+};
+
+/*
+ *	radixsort is least significant digit first, Nbits per pass,
+ *	on keys mapped to unsigned order: signed ints flip the sign
+ *	bit, floats flip the sign bit of positives and every bit of
+ *	negatives. all the histograms come out of one read of the
+ *	input, and a pass whose digit is the same for every key is
+ *	skipped. the scatter goes through a cache line per bucket,
+ *	which is written out whole (software write combining), so
+ *	each pass touches Nbucket lines of destination at a time
+ *	instead of Nbucket random ones per key.
+ */
+static uint32
+f32key(float f)
+{
+	uint32 u;
+	memcpy(&u, &f, sizeof u);
+	return u ^ (-(u >> 31) | 0x80000000u);
+}
+
+static uint64
+f64key(double f)
+{
+	uint64 u;
+	memcpy(&u, &f, sizeof u);
+	return u ^ (-(u >> 63) | 0x8000000000000000ull);
+}
+
+#define X i32
+#define T int32
+#define U uint32
+#define RKEY(x) ((uint32)(x) ^ 0x80000000u)
+#define LESS(x, y) ((x) < (y))
+#define BITON(a, n) simdbitonsort((a), (n))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+#undef BITON
+
+#define X u32
+#define T uint32
+#define U uint32
+#define RKEY(x) (x)
+#define LESS(x, y) ((x) < (y))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X i64
+#define T int64
+#define U uint64
+#define RKEY(x) ((uint64)(x) ^ 0x8000000000000000ull)
+#define LESS(x, y) ((x) < (y))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X u64
+#define T uint64
+#define U uint64
+#define RKEY(x) (x)
+#define LESS(x, y) ((x) < (y))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X f32
+#define T float
+#define U uint32
+#define RKEY(x) f32key(x)
+#define LESS(x, y) (f32key(x) < f32key(y))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X f64
+#define T double
+#define U uint64
+#define RKEY(x) f64key(x)
+#define LESS(x, y) (f64key(x) < f64key(y))
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X kv32
+#define T Kv32
+#define U uint32
+#define RKEY(x) ((x).key)
+#define LESS(x, y) ((x).key < (y).key)
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
+
+#define X kv64
+#define T Kv64
+#define U uint64
+#define RKEY(x) ((x).key)
+#define LESS(x, y) ((x).key < (y).key)
+#include "sortimpl.h"
+#undef X
+#undef T
+#undef U
+#undef RKEY
+#undef LESS
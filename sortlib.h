@@ -0,0 +1,73 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Kv32 Kv32;
+typedef struct Kv64 Kv64;
+
+/*
+ *	key and payload, sorted by key. the payload travels with its
+ *	key through every pass, no index permutation is built.
+ */
+struct Kv32 {
+	uint32 key;
+	uint32 val;
+};
+
+struct Kv64 {
+	uint64 key;
+	uint64 val;
+};
+
+/*
+ *	every type gets the same set of engines:
+ *
+ *	bitonsortX(a, n)	cache-blocked bitonic network, any n
+ *	radixsortX(a, tmp, n)	lsd radix sort, tmp holds n elements
+ *	parsortX(a, tmp, n)	merge sort on the threads of the pool
+ *	sortX(a, n)		the fastest of the above, -1 if out of memory
+ *
+ *	with X one of i32, u32, i64, u64, f32, f64, kv32 or kv64.
+ *	floats sort in ieee total order, minus zero before plus zero.
+ *	parsort wants poolinit; without it, it runs on the caller alone.
+ */
+#define SORTPROTO(X, T)\
+	void bitonsort##X(T *a, int64 n);\
+	void radixsort##X(T *a, T *tmp, int64 n);\
+	void parsort##X(T *a, T *tmp, int64 n);\
+	int sort##X(T *a, int64 n);
+
+SORTPROTO(i32, int32)
+SORTPROTO(u32, uint32)
+SORTPROTO(i64, int64)
+SORTPROTO(u64, uint64)
+SORTPROTO(f32, float)
+SORTPROTO(f64, double)
+SORTPROTO(kv32, Kv32)
+SORTPROTO(kv64, Kv64)
+
+#undef SORTPROTO
+
+/*
+ *	in cubesort.c: bitonic sort across a complete cube, after
+ *	initcube, every rank holding a block of n keys. rank i ends up
+ *	with the i-th smallest block.
+ */
+void cubesort(int32 *a, int64 n);
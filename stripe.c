@@ -0,0 +1,124 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "stripe.h"
+
+static char *layoutname[] = {
+	[Lrow] "row",
+	[Lcol] "col",
+	[Lpanel] "panel",
+};
+
+int
+stripelayout(char *name)
+{
+	int i;
+	for(i = 0; i < nelem(layoutname); i++)
+		if(strcmp(name, layoutname[i]) == 0)
+			return i;
+	return -1;
+}
+
+char *
+stripename(int layout)
+{
+	if(layout < 0 || layout >= nelem(layoutname))
+		return "?";
+	return layoutname[layout];
+}
+
+/*
+ *	row-major is the original m[i*ncols+j], column-major makes
+ *	the pivot search and multiplier walks unit stride, and the
+ *	panel layout stores width columns row-major inside each panel,
+ *	so a panel row is one cache line and a column stays in one
+ *	huge page for all practical nrows.
+ */
+Stripe *
+stripealloc(int nrows, int ncols, int layout, int width)
+{
+	Stripe *s;
+	int npanels;
+
+	s = malloc(sizeof s[0]);
+	memset(s, 0, sizeof s[0]);
+	s->nrows = nrows;
+	s->ncols = ncols;
+	s->layout = layout;
+	switch(layout){
+	case Lrow:
+		s->width = ncols;
+		s->stride = ncols;
+		s->size = (size_t)nrows * ncols;
+		break;
+	case Lcol:
+		s->width = 1;
+		s->stride = 1;
+		s->size = (size_t)nrows * ncols;
+		break;
+	case Lpanel:
+		if(width <= 0)
+			width = Npanel;
+		npanels = (ncols + width-1) / width;
+		s->width = width;
+		s->stride = width;
+		s->size = (size_t)nrows * npanels * width;
+		break;
+	default:
+		fprintf(stderr, "stripealloc: bad layout %d\n", layout);
+		free(s);
+		return NULL;
+	}
+	s->m = hugealloc(s->size * sizeof s->m[0]);
+	if(s->m == NULL){
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+void
+stripefree(Stripe *s)
+{
+	hugefree(s->m, s->size * sizeof s->m[0]);
+	free(s);
+}
+
+double *
+stripecol(Stripe *s, int j)
+{
+	switch(s->layout){
+	case Lrow:
+		return s->m + j;
+	case Lcol:
+		return s->m + (size_t)j*s->nrows;
+	default:
+		return s->m + (size_t)(j/s->width)*s->nrows*s->width + j%s->width;
+	}
+}
+
+int
+striperun(Stripe *s, int j)
+{
+	j = (j/s->width + 1) * s->width;
+	return j < s->ncols ? j : s->ncols;
+}
@@ -0,0 +1,52 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Stripe Stripe;
+
+enum {
+	Lrow,
+	Lcol,
+	Lpanel,
+
+	Npanel = 8,
+};
+
+/*
+ *	a column stripe of nrows x ncols doubles. whatever the layout,
+ *	element (i,j) sits at stripecol(s, j)[i*s->stride], and columns
+ *	j .. striperun(s, j)-1 are contiguous within each row.
+ */
+struct Stripe {
+	double *m;
+	size_t size;
+	int nrows;
+	int ncols;
+	int layout;
+	int width;
+	int stride;
+};
+
+Stripe *stripealloc(int nrows, int ncols, int layout, int width);
+void stripefree(Stripe *s);
+double *stripecol(Stripe *s, int j);
+int striperun(Stripe *s, int j);
+int stripelayout(char *name);
+char *stripename(int layout);
@@ -0,0 +1,258 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include "os.h"
+#include "cube.h"
+#include "stripe.h"
+#include "pool.h"
+#include "tune.h"
+
+enum {
+	Nline = 256,
+	Nreps = 3,	/* the best of these counts for a candidate */
+};
+
+static int tunewidths[] = { 4, 8, 16, 32, 64 };
+static int tunefrags[] = { 0, 4*1024, 16*1024, 64*1024, 256*1024 };
+
+void
+tunedefault(Tune *t)
+{
+	memset(t, 0, sizeof t[0]);
+	t->nranks = 1;
+	t->nthreads = 1;
+	t->layout = Lpanel;
+	t->width = Npanel;
+	t->frag = 0;
+}
+
+char *
+tunefile(void)
+{
+	static char name[Nline];
+	char host[64];
+	char *s;
+
+	s = getenv("MATRIXTUNE");
+	if(s != NULL)
+		return s;
+	if(gethostname(host, sizeof host) == -1)
+		strcpy(host, "localhost");
+	host[sizeof host - 1] = '\0';
+	snprintf(name, sizeof name, "tune.%s", host);
+	return name;
+}
+
+static int
+tuneparse(char *line, char *prog, int *n, Tune *t)
+{
+	char p[Nline], l[Nline];
+
+	if(line[0] == '#')
+		return 0;
+	if(sscanf(line, "%255s %d %d %d %255s %d %d %lf", p, n,
+			&t->nranks, &t->nthreads, l, &t->width, &t->frag, &t->secs) != 8)
+		return 0;
+	t->layout = stripelayout(l);
+	return strcmp(p, prog) == 0 && t->layout != -1 && t->nranks > 0 && t->nthreads > 0;
+}
+
+/* nearest in ratio, since cost grows with a power of n */
+int
+tuneload(char *prog, int n, Tune *t)
+{
+	char line[Nline];
+	FILE *fp;
+	Tune c;
+	double d, dbest;
+	int cn, best;
+
+	fp = fopen(tunefile(), "r");
+	if(fp == NULL)
+		return -1;
+	best = -1;
+	dbest = 0.0;
+	while(fgets(line, sizeof line, fp) != NULL){
+		if(!tuneparse(line, prog, &cn, &c) || cn <= 0)
+			continue;
+		d = fabs(log((double)cn / n));
+		if(best == -1 || d < dbest){
+			best = cn;
+			dbest = d;
+			*t = c;
+		}
+	}
+	fclose(fp);
+	return best;
+}
+
+/* replaces the line for prog at n, leaving the rest alone */
+int
+tunesave(char *prog, int n, Tune *t)
+{
+	char line[Nline], tmp[Nline+8];
+	FILE *fp, *out;
+	Tune c;
+	int cn;
+
+	snprintf(tmp, sizeof tmp, "%s.tmp", tunefile());
+	out = fopen(tmp, "w");
+	if(out == NULL){
+		fprintf(stderr, "tunesave: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	fp = fopen(tunefile(), "r");
+	if(fp == NULL)
+		fprintf(out, "# prog nrows nranks nthreads layout width frag secs\n");
+	while(fp != NULL && fgets(line, sizeof line, fp) != NULL)
+		if(!tuneparse(line, prog, &cn, &c) || cn != n)
+			fputs(line, out);
+	if(fp != NULL)
+		fclose(fp);
+	fprintf(out, "%s %d %d %d %s %d %d %.6f\n", prog, n,
+		t->nranks, t->nthreads, stripename(t->layout), t->width, t->frag, t->secs);
+	if(fclose(out) == EOF || rename(tmp, tunefile()) == -1){
+		fprintf(stderr, "tunesave: %s: %s\n", tunefile(), strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	threads of a rank get cpus of their own, right after the ones
+ *	of the rank before.
+ */
+int
+tuneapply(Tune *t)
+{
+	cubecpus(t->nthreads);
+	cubefragment(t->frag);
+	initcuben(t->nranks);
+	poolinit(t->nthreads);
+	return cube_id;
+}
+
+/*
+ *	initcube forks and endcube exits, so each run gets a child.
+ *	rank 0 hands the time back over a pipe; a run that dies
+ *	without doing so never wins.
+ */
+static double
+tuneone(Tune *t, int n, double (*trial)(Tune *t, int n))
+{
+	double secs;
+	int fd[2];
+	pid_t pid;
+
+	if(pipe(fd) == -1)
+		return HUGE_VAL;
+	fflush(stdout);
+	pid = fork();
+	if(pid == -1){
+		close(fd[0]);
+		close(fd[1]);
+		return HUGE_VAL;
+	}
+	if(pid == 0){
+		close(fd[0]);
+		setenv("PROF", "0", 1);
+		secs = trial(t, n);
+		if(cube_id == 0 && write(fd[1], &secs, sizeof secs) != sizeof secs)
+			fprintf(stderr, "tune: lost a result: %s\n", strerror(errno));
+		endcube();
+	}
+	close(fd[1]);
+	if(read(fd[0], &secs, sizeof secs) != sizeof secs)
+		secs = HUGE_VAL;
+	close(fd[0]);
+	waitpid(pid, NULL, 0);
+	return secs;
+}
+
+static void
+tunetry(char *prog, int n, Tune *t, Tune *best, double (*trial)(Tune *t, int n))
+{
+	double secs;
+	int i;
+
+	t->secs = HUGE_VAL;
+	for(i = 0; i < Nreps; i++){
+		secs = tuneone(t, n, trial);
+		if(secs < t->secs)
+			t->secs = secs;
+	}
+	printf("%s %d: -p %d -t %d -l %s -w %d -f %d  %.6f s\n", prog, n,
+		t->nranks, t->nthreads, stripename(t->layout), t->width, t->frag, t->secs);
+	if(t->secs < best->secs)
+		*best = *t;
+}
+
+/*
+ *	ranks and threads go together since they share the cpus, then
+ *	the layout, then the fragment size, which only matters with
+ *	ranks to send to. best comes in as the starting point.
+ */
+void
+tunesweep(char *prog, int n, int ncpu, Tune *best, double (*trial)(Tune *t, int n))
+{
+	Tune t;
+	int i, p, th;
+
+	t = *best;
+	best->secs = HUGE_VAL;
+	tunetry(prog, n, &t, best, trial);
+
+	for(p = 1; p <= ncpu && p <= n; p = p < ncpu && 2*p > ncpu ? ncpu : 2*p){
+		for(th = 1; p*th <= ncpu; th = th < ncpu/p && 2*th > ncpu/p ? ncpu/p : 2*th){
+			t = *best;
+			t.nranks = p;
+			t.nthreads = th;
+			if(t.nranks != best->nranks || t.nthreads != best->nthreads)
+				tunetry(prog, n, &t, best, trial);
+		}
+	}
+
+	t = *best;
+	t.layout = Lcol;
+	if(t.layout != best->layout)
+		tunetry(prog, n, &t, best, trial);
+	t = *best;
+	t.layout = Lrow;
+	if(t.layout != best->layout)
+		tunetry(prog, n, &t, best, trial);
+	for(i = 0; i < nelem(tunewidths); i++){
+		t = *best;
+		t.layout = Lpanel;
+		t.width = tunewidths[i];
+		if(t.layout != best->layout || t.width != best->width)
+			tunetry(prog, n, &t, best, trial);
+	}
+
+	if(best->nranks > 1){
+		for(i = 0; i < nelem(tunefrags); i++){
+			t = *best;
+			t.frag = tunefrags[i];
+			if(t.frag != best->frag)
+				tunetry(prog, n, &t, best, trial);
+		}
+	}
+}
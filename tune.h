@@ -0,0 +1,56 @@
+/*
+ *	Copyright (c) 2015 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+typedef struct Tune Tune;
+
+/*
+ *	how a stripe solver runs: rank count, threads per rank, the
+ *	stripe layout and panel width, and the broadcast fragment
+ *	size (zero for whole messages). secs is what it took in the
+ *	calibration that picked it.
+ *
+ *	tunesweep goes over the candidates one setting at a time,
+ *	keeping the best of each, and times every one in a child of
+ *	its own with trial. trial sets the cube up with tuneapply,
+ *	runs a short elimination of n rows and returns the time it
+ *	took, the same on every rank. ncpu is how many cpus the ranks
+ *	and threads get to spread over.
+ *
+ *	the winners are kept in a profile per host, $MATRIXTUNE or
+ *	else tune.<hostname>, a line per program and size. tuneload
+ *	picks the one tuned for the size nearest n and returns that
+ *	size, or -1 if there is none.
+ */
+struct Tune {
+	int nranks;
+	int nthreads;
+	int layout;
+	int width;
+	int frag;
+	double secs;
+};
+
+void tunedefault(Tune *t);
+int tuneload(char *prog, int n, Tune *t);
+int tunesave(char *prog, int n, Tune *t);
+void tunesweep(char *prog, int n, int ncpu, Tune *best, double (*trial)(Tune *t, int n));
+int tuneapply(Tune *t);
+char *tunefile(void);